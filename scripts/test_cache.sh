@@ -0,0 +1,69 @@
+#!/bin/sh
+# Program cache regression test. Usage: scripts/test_cache.sh [agamemnon binary]
+
+set -e
+
+agamemnon=${1:-./agamemnon_test}
+scripts=$(dirname "$0")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+fail() {
+	echo "FAIL: $*"
+	exit 1
+}
+
+# Every regression script runs the same from source, when the cache is
+# written and when it is loaded
+for script in "$scripts"/test_*.json; do
+	cp "$script" "$dir/script.json"
+	rm -f "$dir/script.json.agc"
+	"$agamemnon" "$dir/script.json" > "$dir/plain.out" 2>&1 || fail "$script"
+	"$agamemnon" --cache "$dir/script.json" > "$dir/write.out" 2>&1 || fail "$script, writing the cache"
+	[ -f "$dir/script.json.agc" ] || fail "$script, no cache written"
+	"$agamemnon" --cache "$dir/script.json" > "$dir/load.out" 2>&1 || fail "$script, loading the cache"
+done
+
+cat > "$dir/script.json" <<'EOF'
+[
+	{ "command": "declare_memory_region", "name": "mr", "address": "0xfe8ff400", "size": "1024" },
+	{ "command": "repeat", "variable": "i", "count": "4", "body": [
+		{ "command": "write_value", "memory_region": "mr", "offset": { "operator": "shl", "left": "i", "right": "2" }, "width": 32, "value": "i" }
+	] },
+	{ "command": "read_value", "memory_region": "mr", "offset": "0xc", "width": 32 }
+]
+EOF
+rm -f "$dir/script.json.agc"
+expected=3
+
+check() {
+	output=$("$agamemnon" --cache "$dir/script.json" 2>&1) || fail "$1: $output"
+	[ "$output" = "$expected" ] || fail "$1: expected $expected, got $output"
+}
+
+check "writing the cache"
+cp "$dir/script.json.agc" "$dir/good.agc"
+check "loading the cache"
+
+# A damaged cache is rebuilt, never trusted
+size=$(wc -c < "$dir/good.agc")
+for offset in 8 64 200 $((size / 2)) $((size - 1)); do
+	cp "$dir/good.agc" "$dir/script.json.agc"
+	printf '\377' | dd of="$dir/script.json.agc" bs=1 seek="$offset" conv=notrunc 2>/dev/null
+	check "cache damaged at $offset"
+	cmp -s "$dir/script.json.agc" "$dir/good.agc" || fail "cache damaged at $offset not rebuilt"
+done
+
+head -c $((size / 2)) "$dir/good.agc" > "$dir/script.json.agc"
+check "truncated cache"
+cmp -s "$dir/script.json.agc" "$dir/good.agc" || fail "truncated cache not rebuilt"
+
+# A changed timestamp alone keeps the cache, changed contents replace it
+touch "$dir/script.json"
+check "touched script"
+sed 's/"0xc"/"0x8"/' "$dir/script.json" > "$dir/changed.json"
+cat "$dir/changed.json" > "$dir/script.json"
+expected=2
+check "changed script"
+
+echo "cache tests passed"
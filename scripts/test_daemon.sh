@@ -0,0 +1,108 @@
+#!/bin/sh
+# Daemon mode regression test. Usage: scripts/test_daemon.sh [agamemnon binary]
+
+set -e
+
+agamemnon=${1:-./agamemnon_test}
+dir=$(mktemp -d)
+pid=
+
+cleanup() {
+	[ -n "$pid" ] && kill "$pid" 2>/dev/null
+	rm -rf "$dir"
+}
+trap cleanup EXIT
+
+# Sends stdin as one request and prints the response
+request() {
+	python3 -c '
+import socket, sys
+s = socket.socket(socket.AF_UNIX)
+s.connect(sys.argv[1])
+s.sendall(sys.stdin.buffer.read())
+s.shutdown(socket.SHUT_WR)
+while True:
+	data = s.recv(65536)
+	if not data:
+		break
+	sys.stdout.write(data.decode())
+' "$dir/socket"
+}
+
+# expect <response prefix> <request>
+expect() {
+	response=$(printf '%s' "$2" | request)
+	case "$response" in
+		"$1"*) ;;
+		*) echo "FAIL: $2"; echo "expected: $1"; echo "got: $response"; exit 1 ;;
+	esac
+}
+
+cat > "$dir/setup.json" <<'EOF'
+[
+	{ "command": "declare_memory_region", "name": "mr", "address": "0xfe8ff400", "size": "1024" },
+	{ "command": "set_variable", "name": "base", "value": "5" }
+]
+EOF
+
+"$agamemnon" --daemon "$dir/socket" "$dir/setup.json" &
+pid=$!
+while [ ! -S "$dir/socket" ]; do
+	sleep 0.1
+done
+
+# Requests run against the regions of the setup script
+expect "ok
+1234" '[
+	{ "command": "write_value", "memory_region": "mr", "offset": "0", "width": 32, "value": "0x1234" },
+	{ "command": "read_value", "memory_region": "mr", "offset": "0", "width": 32 }
+]'
+
+# Every request starts with the variables of the setup script
+expect "ok" '[ { "command": "set_variable", "name": "base", "value": "6" } ]'
+expect "ok" '[ { "command": "assert", "variable": "base", "value": "5", "condition": true } ]'
+
+# Regions and configuration can only be set up by the setup script
+expect "error: declare_memory_region is not allowed" \
+	'[ { "command": "declare_memory_region", "name": "other", "address": "0xfe900000", "size": "1024" } ]'
+expect "error: set_config is not allowed" \
+	'[ { "command": "repeat", "count": "1", "body": [ { "command": "set_config", "name": "threads", "value": 2 } ] } ]'
+
+# Failed requests leave the daemon usable
+expect "error:" '[ { "command": "no_such_command" } ]'
+expect "error: assertion failed" '[ { "command": "assert", "variable": "base", "value": "6", "condition": true } ]'
+expect "ok
+1234" '[ { "command": "read_value", "memory_region": "mr", "offset": "0", "width": 32 } ]'
+
+# Script files, including a file that runs itself
+echo '[ { "command": "assert", "variable": "base", "value": "5", "condition": true } ]' > "$dir/script.json"
+echo "{ \"run\": \"$dir/loop.json\" }" > "$dir/loop.json"
+expect "ok" "{ \"run\": \"$dir/script.json\" }"
+expect "error: run requests nested" "{ \"run\": \"$dir/loop.json\" }"
+
+# An idle client is dropped after the receive timeout instead of blocking others
+python3 -c '
+import socket, sys, time
+s = socket.socket(socket.AF_UNIX)
+s.connect(sys.argv[1])
+time.sleep(10)
+' "$dir/socket" &
+idle=$!
+sleep 0.5
+start=$(date +%s)
+expect "ok" '[ { "command": "assert", "variable": "base", "value": "5", "condition": true } ]'
+if [ $(( $(date +%s) - start )) -gt 8 ]; then
+	echo "FAIL: request waited for the idle client"
+	exit 1
+fi
+kill "$idle" 2>/dev/null || true
+
+kill "$pid"
+wait "$pid" || true
+pid=
+if [ -e "$dir/socket" ]; then
+	echo "FAIL: socket left behind"
+	exit 1
+fi
+
+echo "daemon tests passed"
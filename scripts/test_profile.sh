@@ -0,0 +1,64 @@
+#!/bin/sh
+# Profiling regression test. Usage: scripts/test_profile.sh [agamemnon binary]
+
+set -e
+
+agamemnon=${1:-./agamemnon_test}
+scripts=$(dirname "$0")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+fail() {
+	echo "FAIL: $*"
+	exit 1
+}
+
+# Every regression script runs unchanged with profiling
+for script in "$scripts"/test_*.json; do
+	"$agamemnon" --profile "$script" > /dev/null 2>&1 || fail "$script"
+done
+
+# The set_config of an unknown option compiles to no instruction
+cat > "$dir/script.json" <<'EOF'
+[
+	{ "command": "set_config", "name": "no_such_option", "value": 1 },
+	{ "command": "declare_memory_region", "name": "mr", "address": "0xfe8ff400", "size": "1024" },
+	{ "command": "repeat", "count": "10", "body": [
+		{ "command": "write_value", "memory_region": "mr", "offset": "0", "width": 32, "value": "1", "count": 16 }
+	] },
+	{ "command": "assert", "variable": "1", "value": "2", "condition": true }
+]
+EOF
+
+# The report is written when the script fails too
+if "$agamemnon" --profile="$dir/profile.json" "$dir/script.json" > /dev/null 2>&1; then
+	fail "script did not fail"
+fi
+
+python3 - "$dir/profile.json" <<'EOF' || fail "JSON profile"
+import json, sys
+
+profile = json.load(open(sys.argv[1]))
+locations = dict((entry["location"], entry) for entry in profile["locations"])
+commands = dict((entry["command"], entry) for entry in profile["commands"])
+
+assert locations["3:2"]["command"] == "declare_memory_region"
+assert locations["4:2"]["command"] == "repeat"
+assert locations["5:3"]["command"] == "write_value"
+assert locations["5:3"]["count"] == 10
+assert locations["5:3"]["bytes"] == 640
+assert locations["4:2"]["bytes"] == 640
+assert locations["7:2"]["command"] == "assert"
+assert commands["write_value"]["count"] == 10
+assert "set_config" not in commands
+for entry in profile["locations"]:
+	assert entry["max_ns"] <= entry["total_ns"]
+EOF
+
+# Text reports, with byte offsets for scripts from standard input
+"$agamemnon" --profile "$dir/script.json" > /dev/null 2> "$dir/report.txt" || true
+grep -q "^5:3 *write_value *10 " "$dir/report.txt" || fail "text report"
+"$agamemnon" --profile < "$dir/script.json" > /dev/null 2> "$dir/report.txt" || true
+grep -q "^offset [0-9]* *write_value *10 " "$dir/report.txt" || fail "text report from standard input"
+
+echo "profile tests passed"
@@ -0,0 +1,72 @@
+#!/bin/sh
+# Stream mode regression test. Usage: scripts/test_stream.sh [agamemnon binary]
+
+set -e
+
+agamemnon=${1:-./agamemnon_test}
+scripts=$(dirname "$0")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+fail() {
+	echo "FAIL: $*"
+	exit 1
+}
+
+# expect_ok <script text>, expect_error <message> <script text>
+expect_ok() {
+	printf '%s' "$1" > "$dir/script.json"
+	"$agamemnon" "$dir/script.json" > /dev/null 2>&1 || fail "normal mode: $1"
+	"$agamemnon" --stream < "$dir/script.json" > /dev/null 2>&1 || fail "stream mode: $1"
+}
+
+expect_error() {
+	printf '%s' "$2" > "$dir/script.json"
+	if output=$("$agamemnon" --stream < "$dir/script.json" 2>&1); then
+		fail "accepted: $2"
+	fi
+	case "$output" in
+		*"$1"*) ;;
+		*) fail "$2: expected $1, got $output" ;;
+	esac
+}
+
+# Every regression script runs the same as a file and from standard input.
+# test_mapping.json reads through partly overlapping regions, which share
+# memory only when merged into one mapping, which stream mode does not do.
+for script in "$scripts"/test_*.json; do
+	[ "$(basename "$script")" = test_mapping.json ] && continue
+	"$agamemnon" --stream "$script" > /dev/null 2>&1 || fail "$script"
+	"$agamemnon" --stream < "$script" > /dev/null 2>&1 || fail "$script from standard input"
+done
+
+set_a='{ "command": "set_variable", "name": "a", "value": "1" }'
+assert_a='{ "command": "assert", "variable": "a", "value": "1", "condition": true }'
+
+expect_ok "[ $set_a, $assert_a ]"
+expect_ok "[]"
+expect_ok "$set_a"
+expect_ok '"a comment string"'
+expect_ok '   [ "comment" , [ ] ]   '
+
+# Brackets, commas and quotes inside strings and comments do not end elements
+expect_ok "[ $set_a, \"a ] string, with \\\" [ brackets\", $assert_a ]"
+expect_ok "// a ] comment
+[
+	/* a block comment with ] [ , and \" */ $set_a, // trailing ]
+	$assert_a /* ** */
+	// last ]
+]
+// after"
+
+# Elements before an error have run, so a bad element only fails late
+expect_error "assertion failed" "[ $set_a, { \"command\": \"assert\", \"variable\": \"a\", \"value\": \"2\", \"condition\": true } ]"
+expect_error "missing element" "[ $set_a, ]"
+expect_error "missing element" "[ $set_a,, $assert_a ]"
+expect_error "missing element" "[ , $set_a ]"
+expect_error "unexpected end of script" "[ $set_a, $assert_a"
+expect_error "unexpected end of script" "[ $set_a /* unterminated"
+expect_error "unexpected data after script" "[ $set_a ] ]"
+expect_error "invalid comment" "[ $set_a / ]"
+
+echo "stream tests passed"
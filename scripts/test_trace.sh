@@ -0,0 +1,81 @@
+#!/bin/sh
+# Access tracing regression test. Usage: scripts/test_trace.sh [agamemnon binary]
+
+set -e
+
+agamemnon=${1:-./agamemnon_test}
+scripts=$(dirname "$0")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+fail() {
+	echo "FAIL: $*"
+	exit 1
+}
+
+# Every regression script runs unchanged with tracing, and its trace prints
+for script in "$scripts"/test_*.json; do
+	"$agamemnon" --trace "$dir/trace.bin" "$script" > /dev/null 2>&1 || fail "$script"
+	"$agamemnon" --print-trace "$dir/trace.bin" > /dev/null || fail "printing the trace of $script"
+done
+
+cat > "$dir/script.json" <<'EOF'
+[
+	{ "command": "declare_memory_region", "name": "regs", "address": "0xfe8ff000", "size": "0x1000" },
+	{ "command": "declare_memory_region", "name": "buf", "address": "0xfe900000", "size": "0x10000" },
+	{ "command": "write_value", "memory_region": "regs", "offset": "0x10", "width": 32, "value": "0xdeadbeef" },
+	{ "command": "read_value", "memory_region": "regs", "offset": "0x10", "width": 32 },
+	{ "command": "write_value", "memory_region": "buf", "offset": "0", "width": 64, "value": "0x5", "value_increment": "1", "count": 16 },
+	{ "command": "write_value", "memory_region": "buf", "offset": "0x40", "width": 64, "value": "0", "count": 2 },
+	{ "command": "write_value", "memory_region": "buf", "offset": "0x60", "width": 64, "value": "0" },
+	{ "command": "compare_memory", "memory_region": "buf", "offset": "0", "width": 64, "value": "0x5", "value_increment": "1",
+		"count": 16, "max_error_count": 10 },
+	{ "command": "poll_value", "memory_region": "regs", "offset": "0x10", "width": 32, "mask": "0x1", "condition": true, "timeout": 100 },
+	{ "command": "poll_value", "memory_region": "regs", "offset": "0x20", "width": 32, "mask": "0x1", "condition": true,
+		"timeout": 0, "timeout_us": 500, "strategy": "spin" },
+	{ "command": "wait_all", "conditions": [
+		{ "memory_region": "regs", "offset": "0x10", "width": 32, "mask": "0x1", "condition": true },
+		{ "memory_region": "regs", "offset": "0x20", "width": 32, "mask": "0x1", "condition": true }
+	], "timeout": 0, "timeout_us": 500, "strategy": "spin" }
+]
+EOF
+
+"$agamemnon" --trace "$dir/trace.bin" "$dir/script.json" > /dev/null || fail "tracing"
+"$agamemnon" --print-trace "$dir/trace.bin" | sed 's/^ *[0-9.]* *//' > "$dir/trace.txt" || fail "printing"
+
+# The fields after the timestamp: kind, location, width, value, then the
+# count (x for elements and poll_end reads, # for the number of a poll read)
+# and the increment
+cat > "$dir/expected.txt" <<'EOF'
+write regs+0x10 32 0xdeadbeef
+read regs+0x10 32 0xdeadbeef
+write buf+0x0 64 0x5 x16 +0x1
+write buf+0x40 64 0x0 x2
+write buf+0x60 64 0x0
+compare buf+0x0 64 0x5 x16 +0x1
+mismatch buf+0x40 64 0x0 x2
+mismatch buf+0x60 64 0x0
+poll regs+0x10 32 0xdeadbeef #1
+poll_end regs+0x10 32 0xdeadbeef
+poll regs+0x20 32 0x0 #1
+EOF
+sed 's/  */ /g' "$dir/trace.txt" | head -11 > "$dir/actual.txt"
+diff "$dir/expected.txt" "$dir/actual.txt" || fail "trace records"
+
+# A poll that never succeeds records its first read, then the last one with
+# the number of reads
+tail -n +12 "$dir/trace.txt" | sed 's/  */ /g' > "$dir/rest.txt"
+grep -q "^poll_end regs+0x20 32 0x0 x[0-9]*$" "$dir/rest.txt" || fail "poll_end of a timed out poll"
+
+# wait_all traces every condition the same way
+grep -q "^poll regs+0x10 32 0xdeadbeef #1$" "$dir/rest.txt" || fail "wait_all first read"
+grep -q "^poll_end regs+0x10 32 0xdeadbeef$" "$dir/rest.txt" || fail "wait_all condition that was met"
+[ "$(grep -c "^poll_end regs+0x20 32 0x0 x" "$dir/rest.txt")" = 2 ] || fail "wait_all condition that timed out"
+
+# Invalid trace files are refused
+echo "not a trace" > "$dir/bad.bin"
+if "$agamemnon" --print-trace "$dir/bad.bin" > /dev/null 2>&1; then
+	fail "invalid trace accepted"
+fi
+
+echo "trace tests passed"
@@ -0,0 +1,226 @@
+/*
+	Copyright (c) 2017 Willem Kemp
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#include "commands.h"
+#include "expressions.h"
+#include "memory_ops.h"
+#include "checksum.h"
+#include "output.h"
+#include "polling.h"
+#include "script_exception.h"
+
+#include <jsoncpp/json/json.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+
+// Measures the interpreter hot paths on the stub memory backend and writes
+// one JSON object per result to stdout.
+
+static const char* region_size = "0x4000000";
+static const int unroll = 1000;
+
+static uint64_t min_time_ns = 200000000;
+
+
+static Json::Value command(const char* name)
+{
+	Json::Value command;
+	command["command"] = name;
+	return command;
+}
+
+static Json::Value binary(const char* op, const Json::Value& left, const Json::Value& right)
+{
+	Json::Value expression;
+	expression["operator"] = op;
+	expression["left"] = left;
+	expression["right"] = right;
+	return expression;
+}
+
+// Runs the program until min_time_ns has passed and returns the average
+// time of one execution
+static double time_program(const program& program, script_context& script_context)
+{
+	uint64_t runs = 1;
+
+	while (true) {
+		uint64_t start = monotonic_ns();
+		for (uint64_t i=0; i < runs; ++i) {
+			program_execute(program, script_context);
+		}
+		uint64_t elapsed = monotonic_ns() - start;
+
+		if (elapsed >= min_time_ns) {
+			return (double)elapsed / runs;
+		}
+		runs = (elapsed > 0) ? std::max(runs * 2, runs * min_time_ns / elapsed + 1) : runs * 2;
+	}
+}
+
+// Times a script of unroll copies of body, per copy
+static double time_unrolled(const Json::Value& setup, const Json::Value& body, script_context& script_context)
+{
+	program setup_program;
+	command_compile(setup, setup_program, script_context);
+	program_execute(setup_program, script_context);
+
+	Json::Value script(Json::arrayValue);
+	for (int i=0; i < unroll; ++i) {
+		script.append(body);
+	}
+
+	program program;
+	command_compile(script, program, script_context);
+	return time_program(program, script_context) / unroll;
+}
+
+static void report(const char* benchmark, const char* access, uint32_t width, uint64_t count, double ns, uint64_t bytes)
+{
+	std::printf("{\"benchmark\":\"%s\",", benchmark);
+	if (access) {
+		std::printf("\"access\":\"%s\",", access);
+	}
+	std::printf("\"width\":%u,\"count\":%llu,\"ns_per_op\":%.2f", width, (unsigned long long)count, ns);
+	if (bytes > 0) {
+		std::printf(",\"mb_per_s\":%.1f", bytes / ns * 1e3);
+	}
+	std::printf("}\n");
+	std::fflush(stdout);
+}
+
+static void bench_interpreter(script_context& script_context)
+{
+	Json::Value setup(Json::arrayValue);
+	const char* names[] = { "a", "b", "c", "d" };
+	for (const char* name : names) {
+		Json::Value set_variable = command("set_variable");
+		set_variable["name"] = name;
+		set_variable["value"] = "0x12345678";
+		setup.append(set_variable);
+	}
+
+	// A constant store is as close to bare dispatch as a command gets
+	Json::Value constant = command("set_variable");
+	constant["name"] = "x";
+	constant["value"] = "0x1";
+	double dispatch = time_unrolled(setup, constant, script_context);
+	report("dispatch", nullptr, 0, 1, dispatch, 0);
+
+	// The costs below are what a command adds to dispatch. Noise can make
+	// the difference negative for the cheapest ones.
+
+	Json::Value variable = command("set_variable");
+	variable["name"] = "x";
+	variable["value"] = "a";
+	report("variable", nullptr, 0, 1, std::max(0.0, time_unrolled(setup, variable, script_context) - dispatch), 0);
+
+	// Five operators over four variables
+	Json::Value expression = command("set_variable");
+	expression["name"] = "x";
+	expression["value"] = binary("and", binary("or", binary("shl", "a", "0x3"), binary("shr", "b", "0x2")), binary("or", "c", "d"));
+	report("expression", nullptr, 0, 5, std::max(0.0, time_unrolled(setup, expression, script_context) - dispatch), 0);
+}
+
+static void bench_bulk(script_context& script_context)
+{
+	Json::Value setup(Json::arrayValue);
+	Json::Value declare = command("declare_memory_region");
+	declare["name"] = "bench";
+	declare["address"] = "0x10000000";
+	declare["size"] = region_size;
+	setup.append(declare);
+
+	program setup_program;
+	command_compile(setup, setup_program, script_context);
+	program_execute(setup_program, script_context);
+
+	// exact is what scripts get by default, vector what RAM regions can use
+	const char* accesses[] = { "exact", "vector" };
+	const uint32_t widths[] = { 8, 16, 32, 64 };
+	const uint64_t counts[] = { 1, 64, 4096, 1048576 };
+
+	for (const char* access : accesses) {
+		for (uint32_t width : widths) {
+			for (uint64_t count : counts) {
+				Json::Value write = command("write_value");
+				write["memory_region"] = "bench";
+				write["offset"] = "0x0";
+				write["width"] = width;
+				write["value"] = "0x1";
+				write["value_increment"] = "0x1";
+				write["count"] = (Json::UInt64)count;
+				write["access"] = access;
+
+				Json::Value compare = command("compare_memory");
+				compare["memory_region"] = "bench";
+				compare["offset"] = "0x0";
+				compare["width"] = width;
+				compare["value"] = "0x1";
+				compare["value_increment"] = "0x1";
+				compare["count"] = (Json::UInt64)count;
+				compare["access"] = access;
+
+				uint64_t bytes = count * width / 8;
+				report("write_value", access, width, count, time_unrolled(Json::Value(Json::arrayValue), write, script_context), bytes);
+				report("compare_memory", access, width, count, time_unrolled(Json::Value(Json::arrayValue), compare, script_context), bytes);
+			}
+		}
+	}
+}
+
+
+int main(int argc, char **argv)
+{
+	try {
+
+		output_init();
+		memory_ops_init();
+		checksum_init();
+		expressions_init();
+		commands_init();
+
+		// agamemnon_bench [min time per benchmark in ms]
+		if (argc > 1) {
+			min_time_ns = strtoull(argv[1], 0, 10) * 1000000;
+		}
+
+		script_context context;
+		bench_interpreter(context);
+		bench_bulk(context);
+
+		return 0;
+
+	} catch (std::exception& e) {
+
+		output_flush();
+
+		std::fprintf(stderr, "bench error:\n");
+		std::fprintf(stderr, "%s\n", e.what());
+
+		return 1;
+	}
+}
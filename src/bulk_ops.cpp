@@ -0,0 +1,114 @@
+/*
+	Copyright (c) 2017 Willem Kemp
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#include "bulk_ops.h"
+#include "worker_pool.h"
+
+#include <algorithm>
+#include <atomic>
+
+
+// Chunks are split at cache line boundaries
+static const uint64_t split_granularity = 64;
+
+// A chunk of a parallel search gives up between steps of this size once a
+// lower chunk has found a mismatch
+static const uint64_t search_step = 256 * 1024;
+
+
+void bulk_fill(void* ptr, uint64_t physical_address, uint32_t width, uint64_t count, uint64_t value, uint64_t increment, access_mode mode)
+{
+	const uint64_t element_size = width / 8;
+
+	if (mode == access_exact || !worker_pool_splits(count * element_size)) {
+		memory_fill(ptr, width, count, value, increment, mode);
+		return;
+	}
+
+	worker_pool_run(count * element_size, split_granularity, physical_address, [&](uint64_t begin, uint64_t end) {
+		uint64_t first = begin / element_size;
+		memory_fill((uint8_t*)ptr + begin, width, (end - begin) / element_size, value + first * increment, increment, mode);
+	});
+}
+
+uint64_t bulk_find_mismatch(const void* ptr, uint64_t physical_address, uint32_t width, uint64_t count, uint64_t value, uint64_t increment, uint64_t mask, access_mode mode)
+{
+	const uint64_t element_size = width / 8;
+
+	if (mode == access_exact || !worker_pool_splits(count * element_size)) {
+		return memory_find_mismatch(ptr, width, count, value, increment, mask, mode);
+	}
+
+	std::atomic<uint64_t> lowest(count);
+
+	worker_pool_run(count * element_size, split_granularity, physical_address, [&](uint64_t begin, uint64_t end) {
+		uint64_t first = begin / element_size;
+		uint64_t last = end / element_size;
+		uint64_t step = search_step / element_size;
+
+		for (uint64_t i = first; i < last && i < lowest; i += step) {
+			uint64_t n = std::min(step, last - i);
+			uint64_t index = i + memory_find_mismatch((const uint8_t*)ptr + i * element_size, width, n, value + i * increment, increment, mask, mode);
+			if (index < i + n) {
+				uint64_t current = lowest;
+				while (index < current && !lowest.compare_exchange_weak(current, index)) {
+				}
+				break;
+			}
+		}
+	});
+
+	return lowest;
+}
+
+void bulk_copy(void* dst, const void* src, uint64_t physical_address, uint32_t width, uint64_t count, access_mode mode)
+{
+	const uint64_t element_size = width / 8;
+
+	if (mode == access_exact || !worker_pool_splits(count * element_size)) {
+		memory_copy(dst, src, width, count, mode);
+		return;
+	}
+
+	worker_pool_run(count * element_size, split_granularity, physical_address, [&](uint64_t begin, uint64_t end) {
+		memory_copy((uint8_t*)dst + begin, (const uint8_t*)src + begin, width, (end - begin) / element_size, mode);
+	});
+}
+
+void bulk_move(void* dst, const void* src, uint64_t dst_physical, uint64_t src_physical, uint32_t width, uint64_t count, access_mode mode)
+{
+	uint64_t size = count * (width / 8);
+	uintptr_t d = (uintptr_t)dst;
+	uintptr_t s = (uintptr_t)src;
+
+	if (dst_physical < src_physical + size && src_physical < dst_physical + size) {
+		if (d - s == dst_physical - src_physical) {
+			memory_move(dst, src, width, count, mode);
+		} else {
+			memory_move_aliased(dst, src, width, count, dst_physical > src_physical);
+		}
+	} else if (d < s + size && s < d + size) {
+		memory_move(dst, src, width, count, mode);
+	} else {
+		bulk_copy(dst, src, dst_physical, width, count, mode);
+	}
+}
@@ -0,0 +1,50 @@
+/*
+	Copyright (c) 2017 Willem Kemp
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#ifndef BULK_OPS_H
+#define BULK_OPS_H
+
+#include "memory_ops.h"
+
+#include <cstdint>
+
+
+// The memory_ops operations, split across the worker pool for large ranges.
+// physical_address is the address of the first element, which places the
+// workers on its NUMA node. Exact accesses always run in order on the
+// calling thread.
+
+void bulk_fill(void* ptr, uint64_t physical_address, uint32_t width, uint64_t count, uint64_t value, uint64_t increment, access_mode mode);
+
+// Returns the lowest mismatching index, as memory_find_mismatch does
+uint64_t bulk_find_mismatch(const void* ptr, uint64_t physical_address, uint32_t width, uint64_t count, uint64_t value, uint64_t increment, uint64_t mask, access_mode mode);
+
+// The ranges must not overlap. physical_address refers to dst.
+void bulk_copy(void* dst, const void* src, uint64_t physical_address, uint32_t width, uint64_t count, access_mode mode);
+
+// As bulk_copy, but overlapping ranges are moved on the calling thread.
+// Overlap is detected on the physical addresses of dst and src, since
+// regions over the same memory may have separate mappings.
+void bulk_move(void* dst, const void* src, uint64_t dst_physical, uint64_t src_physical, uint32_t width, uint64_t count, access_mode mode);
+
+
+#endif
@@ -0,0 +1,238 @@
+/*
+	Copyright (c) 2017 Willem Kemp
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#include "checksum.h"
+
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CHECKSUM_X86_64
+#endif
+
+
+typedef uint32_t (*crc32c_kernel_t)(uint32_t crc, const uint8_t* p, uint64_t size);
+
+// Slicing-by-8 tables for the reflected polynomials
+static uint32_t crc32c_table[8][256];
+static uint32_t crc32_table[8][256];
+static crc32c_kernel_t crc32c_kernel;
+static const char* isa_name = "scalar";
+
+
+static void make_table(uint32_t table[8][256], uint32_t polynomial)
+{
+	for (uint32_t i=0; i < 256; ++i) {
+		uint32_t crc = i;
+		for (int bit=0; bit < 8; ++bit) {
+			crc = (crc >> 1) ^ ((crc & 1) ? polynomial : 0);
+		}
+		table[0][i] = crc;
+	}
+
+	for (uint32_t i=0; i < 256; ++i) {
+		for (int slice=1; slice < 8; ++slice) {
+			table[slice][i] = (table[slice - 1][i] >> 8) ^ table[0][table[slice - 1][i] & 0xff];
+		}
+	}
+}
+
+static uint32_t crc_slicing8(const uint32_t table[8][256], uint32_t crc, const uint8_t* p, uint64_t size)
+{
+	while (size >= 8) {
+		uint32_t low;
+		uint32_t high;
+		memcpy(&low, p, 4);
+		memcpy(&high, p + 4, 4);
+		low ^= crc;
+		crc = table[7][low & 0xff] ^ table[6][(low >> 8) & 0xff] ^ table[5][(low >> 16) & 0xff] ^ table[4][low >> 24] ^
+			table[3][high & 0xff] ^ table[2][(high >> 8) & 0xff] ^ table[1][(high >> 16) & 0xff] ^ table[0][high >> 24];
+		p += 8;
+		size -= 8;
+	}
+
+	while (size-- > 0) {
+		crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xff];
+	}
+
+	return crc;
+}
+
+static uint32_t crc32c_scalar(uint32_t crc, const uint8_t* p, uint64_t size)
+{
+	return crc_slicing8(crc32c_table, crc, p, size);
+}
+
+#ifdef CHECKSUM_X86_64
+
+// One crc32 instruction consumes 8 bytes, which keeps up with the memory
+// bandwidth of a single core for ranges that are not cached.
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t* p, uint64_t size)
+{
+	uint64_t crc64 = crc;
+
+	while (size > 0 && ((uintptr_t)p & 7) != 0) {
+		crc64 = _mm_crc32_u8((uint32_t)crc64, *p++);
+		--size;
+	}
+
+	for (; size >= 8; size -= 8, p += 8) {
+		uint64_t value;
+		memcpy(&value, p, 8);
+		crc64 = _mm_crc32_u64(crc64, value);
+	}
+
+	while (size-- > 0) {
+		crc64 = _mm_crc32_u8((uint32_t)crc64, *p++);
+	}
+
+	return (uint32_t)crc64;
+}
+
+#endif
+
+
+static const uint64_t xxh_prime1 = 0x9e3779b185ebca87ULL;
+static const uint64_t xxh_prime2 = 0xc2b2ae3d27d4eb4fULL;
+static const uint64_t xxh_prime3 = 0x165667b19e3779f9ULL;
+static const uint64_t xxh_prime4 = 0x85ebca77c2b2ae63ULL;
+static const uint64_t xxh_prime5 = 0x27d4eb2f165667c5ULL;
+
+static inline uint64_t rotl64(uint64_t value, int bits)
+{
+	return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t read64(const uint8_t* p)
+{
+	uint64_t value;
+	memcpy(&value, p, 8);
+	return value;
+}
+
+static inline uint32_t read32(const uint8_t* p)
+{
+	uint32_t value;
+	memcpy(&value, p, 4);
+	return value;
+}
+
+static inline uint64_t xxh64_round(uint64_t accumulator, uint64_t input)
+{
+	return rotl64(accumulator + input * xxh_prime2, 31) * xxh_prime1;
+}
+
+static inline uint64_t xxh64_merge(uint64_t hash, uint64_t accumulator)
+{
+	return (hash ^ xxh64_round(0, accumulator)) * xxh_prime1 + xxh_prime4;
+}
+
+static uint64_t xxh64(const uint8_t* p, uint64_t size)
+{
+	const uint64_t seed = 0;
+	const uint8_t* end = p + size;
+	uint64_t hash;
+
+	if (size >= 32) {
+		uint64_t v1 = seed + xxh_prime1 + xxh_prime2;
+		uint64_t v2 = seed + xxh_prime2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - xxh_prime1;
+
+		for (; end - p >= 32; p += 32) {
+			v1 = xxh64_round(v1, read64(p));
+			v2 = xxh64_round(v2, read64(p + 8));
+			v3 = xxh64_round(v3, read64(p + 16));
+			v4 = xxh64_round(v4, read64(p + 24));
+		}
+
+		hash = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+		hash = xxh64_merge(hash, v1);
+		hash = xxh64_merge(hash, v2);
+		hash = xxh64_merge(hash, v3);
+		hash = xxh64_merge(hash, v4);
+	} else {
+		hash = seed + xxh_prime5;
+	}
+
+	hash += size;
+
+	for (; end - p >= 8; p += 8) {
+		hash ^= xxh64_round(0, read64(p));
+		hash = rotl64(hash, 27) * xxh_prime1 + xxh_prime4;
+	}
+
+	if (end - p >= 4) {
+		hash ^= read32(p) * xxh_prime1;
+		hash = rotl64(hash, 23) * xxh_prime2 + xxh_prime3;
+		p += 4;
+	}
+
+	for (; p < end; ++p) {
+		hash ^= *p * xxh_prime5;
+		hash = rotl64(hash, 11) * xxh_prime1;
+	}
+
+	hash ^= hash >> 33;
+	hash *= xxh_prime2;
+	hash ^= hash >> 29;
+	hash *= xxh_prime3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+
+void checksum_init()
+{
+	make_table(crc32c_table, 0x82f63b78);
+	make_table(crc32_table, 0xedb88320);
+	crc32c_kernel = crc32c_scalar;
+
+#ifdef CHECKSUM_X86_64
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("sse4.2")) {
+		isa_name = "sse4.2";
+		crc32c_kernel = crc32c_sse42;
+	}
+#endif
+}
+
+const char* checksum_isa()
+{
+	return isa_name;
+}
+
+uint64_t checksum_compute(checksum_algorithm algorithm, const void* ptr, uint64_t size)
+{
+	const uint8_t* p = (const uint8_t*)ptr;
+
+	switch (algorithm) {
+		case checksum_crc32c:
+			return ~crc32c_kernel(~0U, p, size);
+		case checksum_crc32:
+			return ~crc_slicing8(crc32_table, ~0U, p, size);
+		default:
+			return xxh64(p, size);
+	}
+}
@@ -20,17 +20,29 @@
 	SOFTWARE.
 */
 
-#include "variable.h"
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
 
+#include <cstdint>
 
-variable::variable() :
-	_value(0)
+
+enum checksum_algorithm : uint32_t
 {
+	// CRC-32C (Castagnoli), as used by iSCSI and ext4
+	checksum_crc32c,
 
-}
+	// CRC-32 as used by zlib, Ethernet and PNG
+	checksum_crc32,
 
-variable::variable(const std::string& name, uint64_t value) :
-	_name(name),
-	_value(value)
-{
-}
+	// XXH64 with seed 0, a fast non-cryptographic 64 bit hash
+	checksum_xxh64
+};
+
+
+void checksum_init();
+const char* checksum_isa();
+
+uint64_t checksum_compute(checksum_algorithm algorithm, const void* ptr, uint64_t size);
+
+
+#endif
@@ -24,50 +24,151 @@
 
 
 #include "memory_region.h"
+#include "memory_ops.h"
+#include "bulk_ops.h"
+#include "worker_pool.h"
+#include "checksum.h"
 #include "script_exception.h"
 #include "expressions.h"
 #include "textutils.h"
 #include "logging.h"
+#include "output.h"
+#include "profile.h"
+#include "trace.h"
 
-#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
 #include <chrono>
+#include <exception>
 #include <thread>
-
-
-
-typedef void (*dispatch_script_command_t)(const Json::Value& script, script_context& script_context);
-
-static std::map<std::string, dispatch_script_command_t> command_dispatch_map;
-
-
-static void cmd_set_config(const Json::Value& script, script_context& script_context);
-static void cmd_declare_memory_region(const Json::Value& script, script_context& script_context);
-static void cmd_set_variable(const Json::Value& script, script_context& script_context);
-static void cmd_write_value(const Json::Value& script, script_context& script_context);
-static void cmd_read_value(const Json::Value& script, script_context& script_context);
-static void cmd_poll_value(const Json::Value& script, script_context& script_context);
-static void cmd_delay(const Json::Value& script, script_context& script_context);
-static void cmd_print(const Json::Value& script, script_context& script_context);
-static void cmd_assert(const Json::Value& script, script_context& script_context);
-static void cmd_compare_memory(const Json::Value& script, script_context& script_context);
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+
+typedef void (*compile_script_command_t)(const Json::Value& script, program& program, script_context& script_context);
+typedef void (*execute_instruction_t)(const program& program, const instruction& instruction, script_context& script_context);
+
+static std::map<std::string, compile_script_command_t> command_compile_map;
+static execute_instruction_t execute_table[op_count];
+static const char* opcode_names[op_count];
+
+
+static void compile_set_config(const Json::Value& script, program& program, script_context& script_context);
+static void compile_declare_memory_region(const Json::Value& script, program& program, script_context& script_context);
+static void compile_set_variable(const Json::Value& script, program& program, script_context& script_context);
+static void compile_write_value(const Json::Value& script, program& program, script_context& script_context);
+static void compile_read_value(const Json::Value& script, program& program, script_context& script_context);
+static void compile_poll_value(const Json::Value& script, program& program, script_context& script_context);
+static void compile_delay(const Json::Value& script, program& program, script_context& script_context);
+static void compile_print(const Json::Value& script, program& program, script_context& script_context);
+static void compile_assert(const Json::Value& script, program& program, script_context& script_context);
+static void compile_compare_memory(const Json::Value& script, program& program, script_context& script_context);
+static void compile_repeat(const Json::Value& script, program& program, script_context& script_context);
+static void compile_wait_any(const Json::Value& script, program& program, script_context& script_context);
+static void compile_wait_all(const Json::Value& script, program& program, script_context& script_context);
+static void compile_flush(const Json::Value& script, program& program, script_context& script_context);
+static void compile_dump_memory(const Json::Value& script, program& program, script_context& script_context);
+static void compile_load_memory(const Json::Value& script, program& program, script_context& script_context);
+static void compile_copy_memory(const Json::Value& script, program& program, script_context& script_context);
+static void compile_checksum_memory(const Json::Value& script, program& program, script_context& script_context);
+static void compile_memtest(const Json::Value& script, program& program, script_context& script_context);
+static void compile_parallel(const Json::Value& script, program& program, script_context& script_context);
+
+static void cmd_set_config(const program& program, const instruction& instruction, script_context& script_context);
+static void cmd_declare_memory_region(const program& program, const instruction& instruction, script_context& script_context);
+static void cmd_set_variable(const program& program, const instruction& instruction, script_context& script_context);
+static void cmd_write_value(const program& program, const instruction& instruction, script_context& script_context);
+static void cmd_read_value(const program& program, const instruction& instruction, script_context& script_context);
+static void cmd_poll_value(const program& program, const instruction& instruction, script_context& script_context);
+static void cmd_delay(const program& program, const instruction& instruction, script_context& script_context);
+static void cmd_print(const program& program, const instruction& instruction, script_context& script_context);
+static void cmd_assert(const program& program, const instruction& instruction, script_context& script_context);
+static void cmd_compare_memory(const program& program, const instruction& instruction, script_context& script_context);
+static void cmd_repeat(const program& program, const instruction& instruction, script_context& script_context);
+static void cmd_wait(const program& program, const instruction& instruction, script_context& script_context);
+static void cmd_flush(const program& program, const instruction& instruction, script_context& script_context);
+static void cmd_dump_memory(const program& program, const instruction& instruction, script_context& script_context);
+static void cmd_load_memory(const program& program, const instruction& instruction, script_context& script_context);
+static void cmd_copy_memory(const program& program, const instruction& instruction, script_context& script_context);
+static void cmd_checksum_memory(const program& program, const instruction& instruction, script_context& script_context);
+static void cmd_memtest(const program& program, const instruction& instruction, script_context& script_context);
+static void cmd_parallel(const program& program, const instruction& instruction, script_context& script_context);
+static void cmd_block(const program& program, const instruction& instruction, script_context& script_context);
 
 
 
 void commands_init()
 {
-	command_dispatch_map["set_config"] = cmd_set_config;
-	command_dispatch_map["declare_memory_region"] = cmd_declare_memory_region;
-	command_dispatch_map["set_variable"] = cmd_set_variable;
-	command_dispatch_map["write_value"] = cmd_write_value;
-	command_dispatch_map["read_value"] = cmd_read_value;
-	command_dispatch_map["poll_value"] = cmd_poll_value;
-	command_dispatch_map["delay"] = cmd_delay;
-	command_dispatch_map["print"] = cmd_print;
-	command_dispatch_map["assert"] = cmd_assert;
-	command_dispatch_map["compare_memory"] = cmd_compare_memory;
+	command_compile_map["set_config"] = compile_set_config;
+	command_compile_map["declare_memory_region"] = compile_declare_memory_region;
+	command_compile_map["set_variable"] = compile_set_variable;
+	command_compile_map["write_value"] = compile_write_value;
+	command_compile_map["read_value"] = compile_read_value;
+	command_compile_map["poll_value"] = compile_poll_value;
+	command_compile_map["delay"] = compile_delay;
+	command_compile_map["print"] = compile_print;
+	command_compile_map["assert"] = compile_assert;
+	command_compile_map["compare_memory"] = compile_compare_memory;
+	command_compile_map["repeat"] = compile_repeat;
+	command_compile_map["for"] = compile_repeat;
+	command_compile_map["wait_any"] = compile_wait_any;
+	command_compile_map["wait_all"] = compile_wait_all;
+	command_compile_map["flush"] = compile_flush;
+	command_compile_map["dump_memory"] = compile_dump_memory;
+	command_compile_map["load_memory"] = compile_load_memory;
+	command_compile_map["copy_memory"] = compile_copy_memory;
+	command_compile_map["checksum_memory"] = compile_checksum_memory;
+	command_compile_map["memtest"] = compile_memtest;
+	command_compile_map["parallel"] = compile_parallel;
+
+	execute_table[op_set_config] = cmd_set_config;
+	execute_table[op_declare_memory_region] = cmd_declare_memory_region;
+	execute_table[op_set_variable] = cmd_set_variable;
+	execute_table[op_write_value] = cmd_write_value;
+	execute_table[op_read_value] = cmd_read_value;
+	execute_table[op_poll_value] = cmd_poll_value;
+	execute_table[op_delay] = cmd_delay;
+	execute_table[op_print] = cmd_print;
+	execute_table[op_assert] = cmd_assert;
+	execute_table[op_compare_memory] = cmd_compare_memory;
+	execute_table[op_repeat] = cmd_repeat;
+	execute_table[op_wait] = cmd_wait;
+	execute_table[op_flush] = cmd_flush;
+	execute_table[op_dump_memory] = cmd_dump_memory;
+	execute_table[op_load_memory] = cmd_load_memory;
+	execute_table[op_copy_memory] = cmd_copy_memory;
+	execute_table[op_checksum_memory] = cmd_checksum_memory;
+	execute_table[op_memtest] = cmd_memtest;
+	execute_table[op_parallel] = cmd_parallel;
+	execute_table[op_block] = cmd_block;
+
+	opcode_names[op_set_config] = "set_config";
+	opcode_names[op_declare_memory_region] = "declare_memory_region";
+	opcode_names[op_set_variable] = "set_variable";
+	opcode_names[op_write_value] = "write_value";
+	opcode_names[op_read_value] = "read_value";
+	opcode_names[op_poll_value] = "poll_value";
+	opcode_names[op_delay] = "delay";
+	opcode_names[op_print] = "print";
+	opcode_names[op_assert] = "assert";
+	opcode_names[op_compare_memory] = "compare_memory";
+	opcode_names[op_repeat] = "repeat";
+	opcode_names[op_wait] = "wait";
+	opcode_names[op_flush] = "flush";
+	opcode_names[op_dump_memory] = "dump_memory";
+	opcode_names[op_load_memory] = "load_memory";
+	opcode_names[op_copy_memory] = "copy_memory";
+	opcode_names[op_checksum_memory] = "checksum_memory";
+	opcode_names[op_memtest] = "memtest";
+	opcode_names[op_parallel] = "parallel";
+	opcode_names[op_block] = "block";
 }
 
-void command_process(const Json::Value& script, script_context& script_context)
+void command_compile(const Json::Value& script, program& program, script_context& script_context)
 {
 	// Strings are allowed for comments
 	if (!script.isObject() && !script.isArray() && !script.isString()) {
@@ -76,123 +177,761 @@ void command_process(const Json::Value& script, script_context& script_context)
 
 	if (script.isObject()) {
 		std::string command = script["command"].asString();
-		auto i = command_dispatch_map.find(command);
-		if (i == command_dispatch_map.end()) {
+		auto i = command_compile_map.find(command);
+		if (i == command_compile_map.end()) {
 			throw script_exception("Command not found");
 		} else {
-			((*i).second)(script, script_context);
+			size_t first = program.instructions.size();
+			((*i).second)(script, program, script_context);
+
+			// Nested commands have recorded their own locations already. Some
+			// commands, such as set_config with an unknown name, compile to nothing.
+			program.locations.resize(program.instructions.size(), no_location);
+			if (first < program.locations.size()) {
+				program.locations[first] = script.getOffsetStart();
+			}
 		}
 
-	} else {
+	} else if (script.isArray()) {
 		for (Json::ArrayIndex i=0; i < script.size(); ++i) {
 			const Json::Value& child(script[i]);
-			command_process(child, script_context);
+			command_compile(child, program, script_context);
 		}
 	}
 }
 
+const char* opcode_name(uint16_t op)
+{
+	return op < op_count ? opcode_names[op] : "unknown";
+}
+
+static void execute_profiled(const program& program, const instruction& instruction, script_context& script_context)
+{
+	// Blocks of parallel are accounted by their commands
+	if (instruction.op == op_block) {
+		execute_table[instruction.op](program, instruction, script_context);
+		return;
+	}
+
+	size_t index = &instruction - program.instructions.data();
+	uint64_t location = index < program.locations.size() ? program.locations[index] : no_location;
+	uint64_t bytes = profile_bytes;
+	uint64_t start = monotonic_ns();
+
+	// A failing command is still accounted, as it may be what the run was waiting on
+	try {
+		execute_table[instruction.op](program, instruction, script_context);
+	} catch (...) {
+		profile_record(location, instruction.op, monotonic_ns() - start, profile_bytes - bytes);
+		throw;
+	}
+
+	profile_record(location, instruction.op, monotonic_ns() - start, profile_bytes - bytes);
+}
+
+static void execute_block(const program& program, const instruction* begin, const instruction* end, script_context& script_context)
+{
+	if (profile_enabled) {
+		for (const instruction* i = begin; i != end; i += 1 + i->block_size) {
+			execute_profiled(program, *i, script_context);
+		}
+	} else {
+		for (const instruction* i = begin; i != end; i += 1 + i->block_size) {
+			execute_table[i->op](program, *i, script_context);
+		}
+	}
+}
+
+void program_execute(const program& program, script_context& script_context)
+{
+	const instruction* begin = program.instructions.data();
+	execute_block(program, begin, begin + program.instructions.size(), script_context);
+}
+
+void command_process(const Json::Value& script, script_context& script_context)
+{
+	program program;
+	command_compile(script, program, script_context);
+	program_execute(program, script_context);
+}
+
+
+static string_ref add_string(program& program, const std::string& str)
+{
+	program.strings.push_back(str);
+	return program.strings.size() - 1;
+}
+
+static uint32_t parse_width(const Json::Value& script)
+{
+	int width = script["width"].asInt();
+
+	switch (width) {
+		case 8:
+		case 16:
+		case 32:
+		case 64:
+			return width;
+		default:
+			throw script_exception(fmt() << "invalid data width: " << width);
+	}
+}
+
+static access_mode parse_access(const Json::Value& script)
+{
+	std::string access = script.get("access", "exact").asString();
+
+	if (access == "vector") {
+		return access_vector;
+	} else if (access == "non_temporal") {
+		return access_non_temporal;
+	} else if (access == "exact") {
+		return access_exact;
+	} else {
+		throw script_exception(fmt() << "invalid access mode: " << access);
+	}
+}
+
+static mapping_advice parse_advice(const Json::Value& script)
+{
+	std::string advice = script.get("advice", "normal").asString();
+
+	if (advice == "normal") {
+		return advice_normal;
+	} else if (advice == "sequential") {
+		return advice_sequential;
+	} else if (advice == "random") {
+		return advice_random;
+	} else if (advice == "willneed") {
+		return advice_willneed;
+	} else {
+		throw script_exception(fmt() << "invalid mapping advice: " << advice);
+	}
+}
+
+static uint64_t parse_timeout(const Json::Value& script)
+{
+	uint64_t ms = script["timeout"].asUInt64();
+	uint64_t us = script.get("timeout_us", 0).asUInt64();
+
+	return (ms * 1000 + us) * 1000;
+}
+
+static poll_options parse_poll_options(const Json::Value& script)
+{
+	std::string strategy = script.get("strategy", "backoff").asString();
+	poll_options options;
+
+	if (strategy == "spin") {
+		options.strategy = poll_spin;
+	} else if (strategy == "spin_yield") {
+		options.strategy = poll_spin_yield;
+	} else if (strategy == "backoff") {
+		options.strategy = poll_backoff;
+	} else if (strategy == "sleep") {
+		options.strategy = poll_sleep;
+	} else {
+		throw script_exception(fmt() << "invalid poll strategy: " << strategy);
+	}
+
+	options.spin_ns = script.get("spin_us", 50).asUInt64() * 1000;
+	options.interval_ns = script.get("interval_us", 10000).asUInt64() * 1000;
+
+	return options;
+}
+
+static uint32_t bind_optional_variable(const std::string& name, script_context& script_context)
+{
+	if (name.empty()) {
+		return no_slot;
+	}
+
+	return script_context.bind_variable(name);
+}
+
+static void check_range(const memory_region* memory_region, uint64_t offset, uint64_t size)
+{
+	if (offset > memory_region->size() || size > memory_region->size() - offset) {
+		throw script_exception(fmt() << "range 0x" << std::hex << offset << "+0x" << size << " exceeds memory region " << memory_region->name());
+	}
+}
+
+// Range compare_memory searches on the calling thread after a mismatch
+static const uint64_t nearby_search_size = 1 << 20;
 
-static void cmd_set_config(const Json::Value& script, script_context& script_context)
+static void log_throughput(const char* command, uint64_t size, uint64_t elapsed_ns)
+{
+	double seconds = elapsed_ns / 1e9;
+	double mb_per_second = (seconds > 0) ? (size / 1e6) / seconds : 0;
+
+	profile_count_bytes(size);
+
+	LOG(ll_v) << command << ": " << size << " bytes in " << elapsed_ns / 1000 << "us (" << (uint64_t)mb_per_second << " MB/s)";
+}
+
+static instruction make_instruction(opcode op)
+{
+	instruction instruction;
+	memset(&instruction, 0, sizeof(instruction));
+	instruction.op = op;
+	return instruction;
+}
+
+
+static void compile_set_config(const Json::Value& script, program& program, script_context& script_context)
 {
 	std::string name = script["name"].asString();
 
 	if (name == "loglevel") {
-		log::current_loglevel = script["value"].asInt();
+		instruction instruction = make_instruction(op_set_config);
+		instruction.set_config.option = config_loglevel;
+		instruction.set_config.value = script["value"].asInt();
+		program.instructions.push_back(instruction);
+
+	} else if (name == "log_async") {
+		instruction instruction = make_instruction(op_set_config);
+		instruction.set_config.option = config_log_async;
+		instruction.set_config.value = script["value"].asBool();
+		program.instructions.push_back(instruction);
+
+	} else if (name == "output_format") {
+		std::string format = script["value"].asString();
+		instruction instruction = make_instruction(op_set_config);
+		instruction.set_config.option = config_output_format;
+
+		if (format == "text") {
+			instruction.set_config.value = output_text;
+		} else if (format == "jsonl") {
+			instruction.set_config.value = output_jsonl;
+		} else if (format == "csv") {
+			instruction.set_config.value = output_csv;
+		} else {
+			throw script_exception(fmt() << "invalid output format: " << format);
+		}
+
+		program.instructions.push_back(instruction);
+
+	} else if (name == "threads") {
+		instruction instruction = make_instruction(op_set_config);
+		instruction.set_config.option = config_threads;
+		instruction.set_config.value = script["value"].asUInt();
+		program.instructions.push_back(instruction);
+
+	} else if (name == "cpus") {
+		// Parsed here to report errors at compile time, the value is the string
+		std::string cpus = script["value"].asString();
+		parse_cpu_list(cpus);
+
+		instruction instruction = make_instruction(op_set_config);
+		instruction.set_config.option = config_cpus;
+		instruction.set_config.value = add_string(program, cpus);
+		program.instructions.push_back(instruction);
 	}
+}
 
+static void compile_declare_memory_region(const Json::Value& script, program& program, script_context& script_context)
+{
+	instruction instruction = make_instruction(op_declare_memory_region);
+	instruction.declare_memory_region.region = script_context.bind_memory_region(script["name"].asString());
+	instruction.declare_memory_region.address = tu::parse_hex(script["address"].asString());
+	instruction.declare_memory_region.size = tu::parse_hex(script["size"].asString());
+	instruction.declare_memory_region.options.prefault = script.get("prefault", false).asBool();
+	instruction.declare_memory_region.options.hugepages = script.get("hugepages", false).asBool();
+	instruction.declare_memory_region.options.advice = parse_advice(script);
+	program.instructions.push_back(instruction);
+
+	// Let the pool merge this range with the other regions before anything is mapped
+	const declare_memory_region_args& args(instruction.declare_memory_region);
+	script_context.get_mapping_pool().reserve(args.address, args.size, args.options);
 }
 
-static void cmd_declare_memory_region(const Json::Value& script, script_context& script_context)
+static void compile_set_variable(const Json::Value& script, program& program, script_context& script_context)
 {
-	std::string name = script["name"].asString();
-	uint64_t address = tu::parse_hex(script["address"].asString());
-	uint64_t size = tu::parse_hex(script["size"].asString());
+	instruction instruction = make_instruction(op_set_variable);
+	instruction.set_variable.value = expression_compile(script["value"], program, script_context);
+	instruction.set_variable.variable = script_context.bind_variable(script["name"].asString());
+	program.instructions.push_back(instruction);
+}
+
+static void compile_write_value(const Json::Value& script, program& program, script_context& script_context)
+{
+	instruction instruction = make_instruction(op_write_value);
+	instruction.write_value.region = script_context.find_memory_region(script["memory_region"].asString());
+	instruction.write_value.offset = expression_compile(script["offset"], program, script_context);
+	instruction.write_value.width = parse_width(script);
+	instruction.write_value.value = expression_compile(script["value"], program, script_context);
+	instruction.write_value.count = script.get("count", 1).asInt();
+	instruction.write_value.value_increment = expression_compile(script.get("value_increment", "0"), program, script_context);
+	instruction.write_value.access = parse_access(script);
+	program.instructions.push_back(instruction);
+}
 
-	LOG(ll_vvv) << "declare_memory_region: name=" << name << ", address=" << std::hex << address << ", size=" << size;
+static void compile_read_value(const Json::Value& script, program& program, script_context& script_context)
+{
+	instruction instruction = make_instruction(op_read_value);
+	instruction.read_value.region = script_context.find_memory_region(script["memory_region"].asString());
+	instruction.read_value.offset = expression_compile(script["offset"], program, script_context);
+	instruction.read_value.width = parse_width(script);
+	instruction.read_value.variable = bind_optional_variable(script["variable_name"].asString(), script_context);
+	instruction.read_value.display_prefix = add_string(program, script["display_prefix"].asString());
+	program.instructions.push_back(instruction);
+}
 
-	memory_region* region = new memory_region(name, address, size);
-	script_context.add_memory_region(region);
+static void compile_poll_value(const Json::Value& script, program& program, script_context& script_context)
+{
+	instruction instruction = make_instruction(op_poll_value);
+	instruction.poll_value.region = script_context.find_memory_region(script["memory_region"].asString());
+	instruction.poll_value.offset = expression_compile(script["offset"], program, script_context);
+	instruction.poll_value.width = parse_width(script);
+	instruction.poll_value.condition = script["condition"].asBool();
+	instruction.poll_value.mask = expression_compile(script["mask"], program, script_context);
+	instruction.poll_value.timeout_ns = parse_timeout(script);
+	instruction.poll_value.poll = parse_poll_options(script);
+	program.instructions.push_back(instruction);
 }
 
-static void cmd_set_variable(const Json::Value& script, script_context& script_context)
+static void compile_delay(const Json::Value& script, program& program, script_context& script_context)
 {
-	std::string name = script["name"].asString();
-	uint64_t value = expression_process(script["value"], script_context);
+	int s = script["s"].asInt();
+	int ms = script["ms"].asInt();
+	int us = script["us"].asInt();
 
-	LOG(ll_vvv) << "set_variable: name=" << name << ", value=" << std::hex << value;
+	us += ms * 1000;
+	us += s * 1000 * 1000;
 
-	script_context.set_variable(variable(name, value));
+	instruction instruction = make_instruction(op_delay);
+	instruction.delay.us = us;
+	program.instructions.push_back(instruction);
 }
 
-static void cmd_write_value(const Json::Value& script, script_context& script_context)
+static void add_print_text(program& program, const std::string& text)
 {
-	memory_region* memory_region = script_context.get_memory_region(script["memory_region"].asString());
-	uint64_t offset = expression_process(script["offset"].asString(), script_context);
-	int width = script["width"].asInt();
-	uint64_t value = expression_process(script["value"], script_context);
+	if (text.empty()) {
+		return;
+	}
 
-	int count = script.get("count", 1).asInt();
-	uint64_t value_increment = expression_process(script.get("value_increment", "0"), script_context);
+	print_segment segment = { no_slot, add_string(program, text), 0, 0, false, false };
+	program.print_segments.push_back(segment);
+}
 
+// Parses a placeholder of the form n or n:spec, where spec is an optional
+// '0' for zero padding, an optional field width and one of 'x', 'X' or 'd'.
+// Returns false if the text is not a placeholder.
+static bool parse_placeholder(const std::string& text, print_segment& segment)
+{
+	size_t pos = 0;
+	uint32_t argument = 0;
 
-	if (memory_region == nullptr) {
-		throw script_exception(fmt() << "memory region " << script["memory_region"].asString() << " not found");
+	while (pos < text.size() && isdigit(text[pos])) {
+		argument = argument * 10 + (text[pos++] - '0');
 	}
 
-	LOG(ll_vvv) << "write_value: memory_region=" << memory_region->name() << ", offset=" << std::hex <<  offset << ", value=" << std::hex << value;
+	if (pos == 0 || argument == 0) {
+		return false;
+	}
 
-	switch (width) {
-		case 8: {
-			uint8_t* ptr = (uint8_t*)((uint8_t*)memory_region->mapped_address() + offset);
-			for (int i=0; i < count; ++i) {
-				*ptr++ = value;
-				value += value_increment;
+	segment = { argument - 1, 0, 16, 0, false, false };
+
+	if (pos == text.size()) {
+		return true;
+	}
+
+	if (text[pos++] != ':') {
+		return false;
+	}
+
+	if (pos < text.size() && text[pos] == '0') {
+		segment.zero_pad = true;
+		pos++;
+	}
+
+	uint32_t width = 0;
+	while (pos < text.size() && isdigit(text[pos])) {
+		width = width * 10 + (text[pos++] - '0');
+	}
+
+	if (width > 64) {
+		throw script_exception(fmt() << "print field width too large: {" << text << "}");
+	}
+
+	segment.width = width;
+
+	if (pos + 1 == text.size() && text[pos] == 'd') {
+		segment.base = 10;
+	} else if (pos + 1 == text.size() && text[pos] == 'x') {
+		segment.base = 16;
+	} else if (pos + 1 == text.size() && text[pos] == 'X') {
+		segment.base = 16;
+		segment.upper = true;
+	} else if (pos != text.size()) {
+		return false;
+	}
+
+	return true;
+}
+
+static void compile_print(const Json::Value& script, program& program, script_context& script_context)
+{
+	const Json::Value& arguments(script["arguments"]);
+	std::string message = script["message"].asString();
+
+	if (!arguments.isArray()) {
+		throw script_exception("print arguments must be an array");
+	}
+
+	instruction instruction = make_instruction(op_print);
+	instruction.print.first_segment = program.print_segments.size();
+	instruction.print.first_argument = program.arguments.size();
+	instruction.print.argument_count = arguments.size();
+
+	for (Json::ArrayIndex i=0; i < arguments.size(); ++i) {
+		program.arguments.push_back(expression_compile(arguments[i], program, script_context));
+	}
+
+	// Split the message into literal text and placeholders once
+	std::vector<bool> referenced(arguments.size(), false);
+	std::string text;
+	size_t pos = 0;
+
+	while (pos < message.size()) {
+		size_t open = message.find('{', pos);
+		size_t close = (open == std::string::npos) ? std::string::npos : message.find('}', open);
+
+		if (close == std::string::npos) {
+			text += message.substr(pos);
+			break;
+		}
+
+		print_segment segment;
+		if (parse_placeholder(message.substr(open + 1, close - open - 1), segment) && segment.argument < arguments.size()) {
+			text += message.substr(pos, open - pos);
+			add_print_text(program, text);
+			text.clear();
+
+			program.print_segments.push_back(segment);
+			referenced[segment.argument] = true;
+			pos = close + 1;
+
+		} else {
+			text += message.substr(pos, open + 1 - pos);
+			pos = open + 1;
+		}
+	}
+
+	add_print_text(program, text);
+
+	for (bool found : referenced) {
+		if (!found) {
+			throw script_exception("could not find string placeholder");
+		}
+	}
+
+	instruction.print.segment_count = program.print_segments.size() - instruction.print.first_segment;
+	program.instructions.push_back(instruction);
+}
+
+static void compile_assert(const Json::Value& script, program& program, script_context& script_context)
+{
+	instruction instruction = make_instruction(op_assert);
+	instruction.assertion.variable = expression_compile(script["variable"], program, script_context);
+	instruction.assertion.value = expression_compile(script["value"], program, script_context);
+	instruction.assertion.condition = script["condition"].asBool();
+	program.instructions.push_back(instruction);
+}
+
+static void compile_compare_memory(const Json::Value& script, program& program, script_context& script_context)
+{
+	instruction instruction = make_instruction(op_compare_memory);
+	instruction.compare_memory.region = script_context.find_memory_region(script["memory_region"].asString());
+	instruction.compare_memory.offset = expression_compile(script["offset"], program, script_context);
+	instruction.compare_memory.width = parse_width(script);
+	instruction.compare_memory.value = expression_compile(script["value"], program, script_context);
+	instruction.compare_memory.count = script.get("count", 1).asInt();
+	instruction.compare_memory.value_increment = expression_compile(script.get("value_increment", "0"), program, script_context);
+	instruction.compare_memory.mask = expression_compile(script.get("mask", "0xffffffffffffffff"), program, script_context);
+	// As before the range search, the first mismatch is always reported
+	instruction.compare_memory.max_error_count = std::max(1, script.get("max_error_count", 1).asInt());
+	instruction.compare_memory.access = parse_access(script);
+	instruction.compare_memory.error_variable = bind_optional_variable(script["error_variable"].asString(), script_context);
+	instruction.compare_memory.range_variable = bind_optional_variable(script["range_variable"].asString(), script_context);
+	program.instructions.push_back(instruction);
+}
+
+static void compile_repeat(const Json::Value& script, program& program, script_context& script_context)
+{
+	const Json::Value& body(script["body"]);
+
+	if (!body.isArray()) {
+		throw script_exception("repeat body must be an array");
+	}
+
+	instruction instruction = make_instruction(op_repeat);
+	instruction.repeat.count = expression_compile(script["count"], program, script_context);
+	instruction.repeat.start = expression_compile(script.get("start", "0"), program, script_context);
+	instruction.repeat.step = expression_compile(script.get("step", "1"), program, script_context);
+	instruction.repeat.variable = bind_optional_variable(script["variable"].asString(), script_context);
+
+	// The body is compiled in place after the repeat instruction
+	size_t index = program.instructions.size();
+	program.instructions.push_back(instruction);
+	command_compile(body, program, script_context);
+	program.instructions[index].block_size = program.instructions.size() - index - 1;
+}
+
+static void compile_wait(const Json::Value& script, program& program, script_context& script_context, bool all)
+{
+	const Json::Value& conditions(script["conditions"]);
+
+	if (!conditions.isArray() || conditions.size() == 0) {
+		throw script_exception("wait conditions must be a non-empty array");
+	}
+
+	if (conditions.size() > 64) {
+		throw script_exception("a wait can watch at most 64 conditions");
+	}
+
+	instruction instruction = make_instruction(op_wait);
+	instruction.wait.all = all;
+	instruction.wait.first_condition = program.wait_conditions.size();
+	instruction.wait.condition_count = conditions.size();
+	instruction.wait.timeout_ns = parse_timeout(script);
+	instruction.wait.poll = parse_poll_options(script);
+
+	for (Json::ArrayIndex i=0; i < conditions.size(); ++i) {
+		const Json::Value& condition(conditions[i]);
+		wait_condition wait_condition;
+		wait_condition.region = script_context.find_memory_region(condition["memory_region"].asString());
+		wait_condition.width = parse_width(condition);
+		wait_condition.offset = expression_compile(condition["offset"], program, script_context);
+		wait_condition.mask = expression_compile(condition["mask"], program, script_context);
+		wait_condition.condition = condition["condition"].asBool();
+		program.wait_conditions.push_back(wait_condition);
+	}
+
+	instruction.wait.fired_variable = bind_optional_variable(script["fired_variable"].asString(), script_context);
+	instruction.wait.elapsed_variable = bind_optional_variable(script["elapsed_variable"].asString(), script_context);
+	program.instructions.push_back(instruction);
+}
+
+static void compile_flush(const Json::Value& script, program& program, script_context& script_context)
+{
+	program.instructions.push_back(make_instruction(op_flush));
+}
+
+static void compile_wait_any(const Json::Value& script, program& program, script_context& script_context)
+{
+	compile_wait(script, program, script_context, false);
+}
+
+static void compile_wait_all(const Json::Value& script, program& program, script_context& script_context)
+{
+	compile_wait(script, program, script_context, true);
+}
+
+static void compile_dump_memory(const Json::Value& script, program& program, script_context& script_context)
+{
+	instruction instruction = make_instruction(op_dump_memory);
+	instruction.dump_memory.region = script_context.find_memory_region(script["memory_region"].asString());
+	instruction.dump_memory.offset = expression_compile(script.get("offset", "0"), program, script_context);
+	instruction.dump_memory.size = expression_compile(script["size"], program, script_context);
+	instruction.dump_memory.file = add_string(program, script["file"].asString());
+	program.instructions.push_back(instruction);
+}
+
+
+static void compile_load_memory(const Json::Value& script, program& program, script_context& script_context)
+{
+	instruction instruction = make_instruction(op_load_memory);
+	instruction.load_memory.region = script_context.find_memory_region(script["memory_region"].asString());
+	instruction.load_memory.offset = expression_compile(script.get("offset", "0"), program, script_context);
+	instruction.load_memory.file = add_string(program, script["file"].asString());
+	instruction.load_memory.width = script.isMember("width") ? parse_width(script) : 8;
+	instruction.load_memory.access = parse_access(script);
+	program.instructions.push_back(instruction);
+}
+
+
+static void compile_copy_memory(const Json::Value& script, program& program, script_context& script_context)
+{
+	instruction instruction = make_instruction(op_copy_memory);
+	instruction.copy_memory.source_region = script_context.find_memory_region(script["source_region"].asString());
+	instruction.copy_memory.source_offset = expression_compile(script.get("source_offset", "0"), program, script_context);
+	instruction.copy_memory.destination_region = script_context.find_memory_region(script["destination_region"].asString());
+	instruction.copy_memory.destination_offset = expression_compile(script.get("destination_offset", "0"), program, script_context);
+	instruction.copy_memory.size = expression_compile(script["size"], program, script_context);
+	instruction.copy_memory.width = script.isMember("width") ? parse_width(script) : 8;
+	instruction.copy_memory.access = parse_access(script);
+	program.instructions.push_back(instruction);
+}
+
+
+static void compile_checksum_memory(const Json::Value& script, program& program, script_context& script_context)
+{
+	instruction instruction = make_instruction(op_checksum_memory);
+	instruction.checksum_memory.region = script_context.find_memory_region(script["memory_region"].asString());
+	instruction.checksum_memory.offset = expression_compile(script.get("offset", "0"), program, script_context);
+	instruction.checksum_memory.size = expression_compile(script["size"], program, script_context);
+	instruction.checksum_memory.variable = bind_optional_variable(script["variable"].asString(), script_context);
+
+	std::string algorithm = script.get("algorithm", "crc32c").asString();
+	if (algorithm == "crc32c") {
+		instruction.checksum_memory.algorithm = checksum_crc32c;
+	} else if (algorithm == "crc32") {
+		instruction.checksum_memory.algorithm = checksum_crc32;
+	} else if (algorithm == "xxh64") {
+		instruction.checksum_memory.algorithm = checksum_xxh64;
+	} else {
+		throw script_exception(fmt() << "invalid checksum algorithm: " << algorithm);
+	}
+
+	if (script.isMember("value")) {
+		instruction.checksum_memory.check = true;
+		instruction.checksum_memory.value = expression_compile(script["value"], program, script_context);
+		instruction.checksum_memory.condition = script.get("condition", true).asBool();
+	}
+
+	program.instructions.push_back(instruction);
+}
+
+
+static const char* memtest_pattern_names[] = { "walking_ones", "walking_zeros", "checkerboard", "march_c", "address", "lfsr" };
+
+static void compile_memtest(const Json::Value& script, program& program, script_context& script_context)
+{
+	instruction instruction = make_instruction(op_memtest);
+	instruction.memtest.region = script_context.find_memory_region(script["memory_region"].asString());
+	instruction.memtest.offset = expression_compile(script.get("offset", "0"), program, script_context);
+	instruction.memtest.size = expression_compile(script["size"], program, script_context);
+	instruction.memtest.width = script.isMember("width") ? parse_width(script) : 64;
+	instruction.memtest.seed = expression_compile(script.get("seed", "1"), program, script_context);
+	instruction.memtest.access = parse_access(script);
+	instruction.memtest.max_failures = script.get("max_failures", 16).asUInt();
+	instruction.memtest.error_variable = bind_optional_variable(script["error_variable"].asString(), script_context);
+
+	std::string pattern = script["pattern"].asString();
+	auto name = std::find(std::begin(memtest_pattern_names), std::end(memtest_pattern_names), pattern);
+	if (name == std::end(memtest_pattern_names)) {
+		throw script_exception(fmt() << "invalid memtest pattern: " << pattern);
+	}
+	instruction.memtest.pattern = (memtest_pattern)(name - std::begin(memtest_pattern_names));
+
+	program.instructions.push_back(instruction);
+}
+
+
+static void compile_parallel(const Json::Value& script, program& program, script_context& script_context)
+{
+	const Json::Value& blocks(script["blocks"]);
+
+	if (!blocks.isArray()) {
+		throw script_exception("parallel blocks must be an array");
+	}
+
+	// Every block is compiled in place behind an op_block header
+	size_t index = program.instructions.size();
+	program.instructions.push_back(make_instruction(op_parallel));
+
+	for (Json::ArrayIndex i=0; i < blocks.size(); ++i) {
+		if (!blocks[i].isArray()) {
+			throw script_exception("parallel block must be an array");
+		}
+
+		size_t header = program.instructions.size();
+		program.instructions.push_back(make_instruction(op_block));
+		command_compile(blocks[i], program, script_context);
+		program.instructions[header].block_size = program.instructions.size() - header - 1;
+
+		// Regions and configuration are shared by all threads
+		for (size_t j = header + 1; j < program.instructions.size(); ++j) {
+			opcode op = program.instructions[j].op;
+			if (op == op_declare_memory_region || op == op_set_config) {
+				throw script_exception("declare_memory_region and set_config are not allowed in a parallel block");
 			}
+		}
+	}
+
+	program.instructions[index].block_size = program.instructions.size() - index - 1;
+}
+
+
+static void cmd_set_config(const program& program, const instruction& instruction, script_context& script_context)
+{
+	switch (instruction.set_config.option) {
+		case config_loglevel: {
+			log::current_loglevel = instruction.set_config.value;
 		} break;
-		case 16: {
-			uint16_t* ptr = (uint16_t*)((uint8_t*)memory_region->mapped_address() + offset);
-			for (int i=0; i < count; ++i) {
-				*ptr++ = value;
-				value += value_increment;
-			}
+		case config_output_format: {
+			output_set_format((output_format)instruction.set_config.value);
 		} break;
-		case 32: {
-			uint32_t* ptr = (uint32_t*)((uint8_t*)memory_region->mapped_address() + offset);
-			for (int i=0; i < count; ++i) {
-				*ptr++ = value;
-				value += value_increment;
-			}
+		case config_log_async: {
+			log::set_async(instruction.set_config.value != 0);
 		} break;
-		case 64: {
-			uint64_t* ptr = (uint64_t*)((uint8_t*)memory_region->mapped_address() + offset);
-			for (int i=0; i < count; ++i) {
-				*ptr++ = value;
-				value += value_increment;
-			}
+		case config_threads: {
+			worker_pool_set_threads(instruction.set_config.value);
+		} break;
+		case config_cpus: {
+			worker_pool_set_cpus(parse_cpu_list(program.strings[instruction.set_config.value]));
 		} break;
-		default: {
-			throw script_exception(fmt() << "invalid data width: " << width);
-		}
 	}
 }
 
-static void cmd_read_value(const Json::Value& script, script_context& script_context)
+static void cmd_declare_memory_region(const program& program, const instruction& instruction, script_context& script_context)
 {
-	memory_region* memory_region = script_context.get_memory_region(script["memory_region"].asString());
-	uint64_t offset = expression_process(script["offset"].asString(), script_context);
-	int width = script["width"].asInt();
-	std::string variable_name = script["variable_name"].asString();
-	std::string display_prefix = script["display_prefix"].asString();
+	const declare_memory_region_args& args(instruction.declare_memory_region);
+	std::string name = script_context.memory_region_name(args.region);
+
+	LOG(ll_vvv) << "declare_memory_region: name=" << name << ", address=" << std::hex << args.address << ", size=" << args.size;
+
+	void* mapped_address = script_context.get_mapping_pool().map(args.address, args.size, args.options);
+	memory_region* region = new memory_region(name, args.address, args.size, mapped_address);
+	script_context.add_memory_region(args.region, region);
 
-	if (memory_region == nullptr) {
-		throw script_exception(fmt() << "memory region " << script["memory_region"].asString() << " not found");
+	if (trace_enabled) {
+		trace_declare_region(args.region, name, args.address, args.size);
 	}
+}
+
+static void cmd_set_variable(const program& program, const instruction& instruction, script_context& script_context)
+{
+	const set_variable_args& args(instruction.set_variable);
+	uint64_t value = expression_evaluate(program, args.value, script_context);
+
+	LOG(ll_vvv) << "set_variable: name=" << script_context.variable_name(args.variable) << ", value=" << std::hex << value;
+
+	script_context.set_variable(args.variable, value);
+}
+
+static void cmd_write_value(const program& program, const instruction& instruction, script_context& script_context)
+{
+	const write_value_args& args(instruction.write_value);
+	memory_region* memory_region = script_context.get_memory_region(args.region);
+	uint64_t offset = expression_evaluate(program, args.offset, script_context);
+	uint64_t value = expression_evaluate(program, args.value, script_context);
+	int64_t count = args.count;
+	uint64_t value_increment = expression_evaluate(program, args.value_increment, script_context);
+
+	LOG(ll_vvv) << "write_value: memory_region=" << memory_region->name() << ", offset=" << std::hex <<  offset << ", value=" << std::hex << value;
+
+	if (count > 0) {
+		void* ptr = (uint8_t*)memory_region->mapped_address() + offset;
+		bulk_fill(ptr, memory_region->address() + offset, args.width, count, value, value_increment, args.access);
+		profile_count_bytes(count * args.width / 8);
+		trace_access(args.region, offset, args.width, value, value_increment, count, trace_write);
+	}
+}
+
+static void cmd_read_value(const program& program, const instruction& instruction, script_context& script_context)
+{
+	const read_value_args& args(instruction.read_value);
+	memory_region* memory_region = script_context.get_memory_region(args.region);
+	uint64_t offset = expression_evaluate(program, args.offset, script_context);
+	const std::string& display_prefix(program.strings[args.display_prefix]);
 
 	LOG(ll_vvv) << "read_value: memory_region=" << memory_region->name() << ", offset=" << std::hex << offset;
 
 	uint64_t value = 0;
 
-	switch (width) {
+	switch (args.width) {
 		case 8: {
 			uint8_t* ptr = (uint8_t*)((uint8_t*)memory_region->mapped_address() + offset);
 			value = *ptr;
@@ -209,208 +948,903 @@ static void cmd_read_value(const Json::Value& script, script_context& script_con
 			uint64_t* ptr = (uint64_t*)((uint8_t*)memory_region->mapped_address() + offset);
 			value = *ptr;
 		} break;
-		default: {
-			throw script_exception(fmt() << "invalid data width: " << width);
+	}
+
+	profile_count_bytes(args.width / 8);
+	trace_access(args.region, offset, args.width, value, 0, 1, trace_read);
+
+	if (args.variable != no_slot) {
+		script_context.set_variable(args.variable, value);
+	}
+
+	switch (output_get_format()) {
+		case output_text: {
+			output_write(display_prefix);
+			output_write_hex(value);
+		} break;
+		case output_jsonl: {
+			output_write("{\"command\":\"read_value\",\"memory_region\":");
+			output_write_json_string(memory_region->name());
+			output_write(",\"offset\":\"0x");
+			output_write_hex(offset);
+			output_write("\",\"width\":");
+			output_write_dec(args.width);
+			output_write(",\"value\":\"0x");
+			output_write_hex(value);
+			output_write("\"}");
+		} break;
+		case output_csv: {
+			output_write("read_value,");
+			output_write_csv_string(memory_region->name());
+			output_write(",0x");
+			output_write_hex(offset);
+			output_write(',');
+			output_write_dec(args.width);
+			output_write(",0x");
+			output_write_hex(value);
+		} break;
+	}
+
+	output_write('\n');
+}
+
+static void cmd_poll_value(const program& program, const instruction& instruction, script_context& script_context)
+{
+	const poll_value_args& args(instruction.poll_value);
+	memory_region* memory_region = script_context.get_memory_region(args.region);
+	uint64_t offset = expression_evaluate(program, args.offset, script_context);
+	uint64_t mask = expression_evaluate(program, args.mask, script_context);
+
+	LOG(ll_vvv) << "poll_value: memory_region=" << memory_region->name() << ", offset=" << std::hex << offset;
+
+	const void* ptr = (const uint8_t*)memory_region->mapped_address() + offset;
+	uint32_t width = args.width;
+	bool condition = args.condition;
+
+	trace_poll_state trace_state = { 0, 0 };
+
+	poll_result result = poll_until([&]() {
+		uint64_t value = memory_read(ptr, width);
+		trace_poll_sample(trace_state, args.region, offset, width, value);
+		return ((value & mask) > 0) == condition;
+	}, args.timeout_ns, args.poll);
+
+	profile_count_bytes(result.iterations * width / 8);
+	trace_poll_finish(trace_state, args.region, offset, width);
+
+	if (!result.satisfied) {
+		LOG(ll_v) << "timeout reached while polling value";
+	}
+
+	LOG(ll_vv) << "poll_value: iterations=" << result.iterations << ", latency=" << result.elapsed_ns / 1000 << "us";
+}
+
+static void cmd_delay(const program& program, const instruction& instruction, script_context& script_context)
+{
+	LOG(ll_vvv) << "delay: us=" << instruction.delay.us;
+
+	std::this_thread::sleep_for(std::chrono::microseconds(instruction.delay.us));
+}
+
+static void cmd_print(const program& program, const instruction& instruction, script_context& script_context)
+{
+	const print_args& args(instruction.print);
+	std::string message;
+
+	for (uint32_t i=0; i < args.segment_count; ++i) {
+		const print_segment& segment(program.print_segments[args.first_segment + i]);
+
+		if (segment.argument == no_slot) {
+			message += program.strings[segment.text];
+		} else {
+			char text[64];
+			uint64_t value = expression_evaluate(program, program.arguments[args.first_argument + segment.argument], script_context);
+			size_t length = tu::format_uint(text, value, segment.base, segment.width, segment.zero_pad, segment.upper);
+			message.append(text, length);
 		}
 	}
 
-	if (!variable_name.empty()) {
-		script_context.set_variable(variable(variable_name, value));
+	switch (output_get_format()) {
+		case output_text: {
+			output_write(message);
+		} break;
+		case output_jsonl: {
+			output_write("{\"command\":\"print\",\"message\":");
+			output_write_json_string(message);
+			output_write('}');
+		} break;
+		case output_csv: {
+			output_write("print,");
+			output_write_csv_string(message);
+		} break;
 	}
 
-	std::cout << display_prefix << std::hex << value << std::endl;
+	output_write('\n');
 }
 
-static void cmd_poll_value(const Json::Value& script, script_context& script_context)
+static void cmd_assert(const program& program, const instruction& instruction, script_context& script_context)
 {
+	const assert_args& args(instruction.assertion);
+	uint64_t variable = expression_evaluate(program, args.variable, script_context);
+	uint64_t value = expression_evaluate(program, args.value, script_context);
 
-	memory_region* memory_region = script_context.get_memory_region(script["memory_region"].asString());
-	uint64_t offset = expression_process(script["offset"].asString(), script_context);
-	int width = script["width"].asInt();
-	bool condition = script["condition"].asBool();
-	uint64_t mask = expression_process(script["mask"], script_context);
-	int timeout = script["timeout"].asInt();
+	LOG(ll_vvv) << "assert: variable="<<  std::hex << variable << ", value=" << std::hex << value;
 
-	if (memory_region == nullptr) {
-		throw script_exception(fmt() << "memory region " << script["memory_region"].asString() << " not found");
+	if ((variable == value) != args.condition) {
+		throw script_exception("assertion failed");
 	}
+}
 
-	LOG(ll_vvv) << "poll_value: memory_region=" << memory_region->name() << ", offset=" << std::hex << offset;
+static void cmd_compare_memory(const program& program, const instruction& instruction, script_context& script_context)
+{
+	const compare_memory_args& args(instruction.compare_memory);
+	memory_region* memory_region = script_context.get_memory_region(args.region);
+	uint64_t offset = expression_evaluate(program, args.offset, script_context);
+	uint64_t value = expression_evaluate(program, args.value, script_context);
+	int64_t count = args.count;
+	uint64_t value_increment = expression_evaluate(program, args.value_increment, script_context);
+	uint64_t mask = expression_evaluate(program, args.mask, script_context);
 
-	uint64_t value = 0;
+	LOG(ll_vvv) << "compare_memory: memory_region=" << memory_region->name() << ", offset=" << std::hex << offset << ", count=" << count << ", value_increment=" << std::hex << value_increment;
 
-	auto mark = std::chrono::high_resolution_clock::now();
+	// Consecutive mismatching elements are collected into a single range
+	struct mismatch_range
+	{
+		uint64_t offset;
+		uint64_t count;
+		uint64_t expected;
+		uint64_t actual;
+	};
+
+	std::vector<mismatch_range> ranges;
+	uint64_t element_size = args.width / 8;
+	const uint8_t* base = (const uint8_t*)memory_region->mapped_address() + offset;
+	int64_t error_count = 0;
+	int64_t index = 0;
+
+	while (index < count && error_count < args.max_error_count) {
+		const uint8_t* ptr = base + index * element_size;
+		uint64_t expected = value + index * value_increment;
+		uint64_t remaining = count - index;
+
+		// Mismatches tend to cluster, so after one the next is first searched
+		// for nearby on this thread. The worker pool is only used to jump
+		// over the clean range that follows.
+		uint64_t nearby = (error_count > 0) ? std::min(remaining, nearby_search_size / element_size) : 0;
+		uint64_t found = (nearby > 0) ? memory_find_mismatch(ptr, args.width, nearby, expected, value_increment, mask, args.access) : 0;
+
+		if (found == nearby && nearby < remaining) {
+			found += bulk_find_mismatch(ptr + nearby * element_size, memory_region->address() + offset + (index + nearby) * element_size,
+				args.width, remaining - nearby, expected + nearby * value_increment, value_increment, mask, args.access);
+		}
 
-	do {
-		switch (width) {
-			case 8: {
-				uint8_t* ptr = (uint8_t*)((uint8_t*)memory_region->mapped_address() + offset);
-				value = *ptr;
-			} break;
-			case 16: {
-				uint16_t* ptr = (uint16_t*)((uint8_t*)memory_region->mapped_address() + offset);
-				value = *ptr;
+		index += found;
+		if (index >= count) {
+			break;
+		}
+
+		uint64_t mismatch_offset = offset + index * element_size;
+		if (!ranges.empty() && ranges.back().offset + ranges.back().count * element_size == mismatch_offset) {
+			ranges.back().count++;
+		} else {
+			uint64_t actual = memory_read(base + index * element_size, args.width);
+			expected = (value + index * value_increment) & width_mask(args.width);
+			ranges.push_back({ mismatch_offset, 1, expected, actual });
+		}
+
+		error_count++;
+		index++;
+	}
+
+	profile_count_bytes(std::min(index, count) * element_size);
+	trace_access(args.region, offset, args.width, value, value_increment, std::min(index, count), trace_compare);
+	if (trace_enabled) {
+		for (const mismatch_range& range : ranges) {
+			trace_append(args.region, range.offset, args.width, range.actual, 0, range.count, trace_mismatch);
+		}
+	}
+
+	if (args.error_variable != no_slot) {
+		script_context.set_variable(args.error_variable, error_count);
+	}
+
+	if (args.range_variable != no_slot) {
+		script_context.set_variable(args.range_variable, ranges.size());
+	}
+
+	if (ranges.empty()) {
+		return;
+	}
+
+	for (const mismatch_range& range : ranges) {
+		switch (output_get_format()) {
+			case output_text: {
+				output_write("At offset 0x");
+				output_write_hex(range.offset);
+				if (range.count > 1) {
+					output_write(", ");
+					output_write_dec(range.count);
+					output_write(" consecutive mismatches, first expected 0x");
+				} else {
+					output_write(", expected 0x");
+				}
+				output_write_hex(range.expected);
+				output_write(", got 0x");
+				output_write_hex(range.actual);
 			} break;
-			case 32: {
-				uint32_t* ptr = (uint32_t*)((uint8_t*)memory_region->mapped_address() + offset);
-				value = *ptr;
+			case output_jsonl: {
+				output_write("{\"command\":\"compare_memory\",\"memory_region\":");
+				output_write_json_string(memory_region->name());
+				output_write(",\"offset\":\"0x");
+				output_write_hex(range.offset);
+				output_write("\",\"count\":");
+				output_write_dec(range.count);
+				output_write(",\"expected\":\"0x");
+				output_write_hex(range.expected);
+				output_write("\",\"actual\":\"0x");
+				output_write_hex(range.actual);
+				output_write("\"}");
 			} break;
-			case 64: {
-				uint64_t* ptr = (uint64_t*)((uint8_t*)memory_region->mapped_address() + offset);
-				value = *ptr;
+			case output_csv: {
+				output_write("compare_memory,");
+				output_write_csv_string(memory_region->name());
+				output_write(",0x");
+				output_write_hex(range.offset);
+				output_write(',');
+				output_write_dec(range.count);
+				output_write(",0x");
+				output_write_hex(range.expected);
+				output_write(",0x");
+				output_write_hex(range.actual);
 			} break;
-			default: {
-				throw script_exception(fmt() << "invalid data width: " << width);
+		}
+
+		output_write('\n');
+	}
+
+	if (output_get_format() == output_text) {
+		output_write("compare_memory: ");
+		output_write_dec(error_count);
+		output_write(" mismatches in ");
+		output_write_dec(ranges.size());
+		output_write(" ranges\n");
+	}
+}
+
+static void cmd_repeat(const program& program, const instruction& instruction, script_context& script_context)
+{
+	const repeat_args& args(instruction.repeat);
+	uint64_t count = expression_evaluate(program, args.count, script_context);
+	uint64_t value = expression_evaluate(program, args.start, script_context);
+	uint64_t step = expression_evaluate(program, args.step, script_context);
+
+	LOG(ll_vvv) << "repeat: count=" << count << ", start=" << std::hex << value << ", step=" << std::hex << step;
+
+	auto begin = &instruction + 1;
+	auto end = begin + instruction.block_size;
+
+	for (uint64_t i=0; i < count; ++i) {
+		if (args.variable != no_slot) {
+			script_context.set_variable(args.variable, value);
+		}
+
+		execute_block(program, begin, end, script_context);
+		value += step;
+	}
+}
+
+static void cmd_flush(const program& program, const instruction& instruction, script_context& script_context)
+{
+	output_flush();
+}
+
+static void cmd_wait(const program& program, const instruction& instruction, script_context& script_context)
+{
+	const wait_args& args(instruction.wait);
+
+	struct watch
+	{
+		const void* ptr;
+		uint32_t width;
+		uint64_t mask;
+		bool condition;
+		uint32_t region;
+		uint64_t offset;
+		trace_poll_state trace_state;
+	};
+
+	watch watches[64];
+	uint32_t count = args.condition_count;
+
+	for (uint32_t i=0; i < count; ++i) {
+		const wait_condition& condition(program.wait_conditions[args.first_condition + i]);
+		memory_region* memory_region = script_context.get_memory_region(condition.region);
+		uint64_t offset = expression_evaluate(program, condition.offset, script_context);
+
+		watches[i].ptr = (const uint8_t*)memory_region->mapped_address() + offset;
+		watches[i].width = condition.width;
+		watches[i].mask = expression_evaluate(program, condition.mask, script_context);
+		watches[i].condition = condition.condition;
+		watches[i].region = condition.region;
+		watches[i].offset = offset;
+		watches[i].trace_state = { 0, 0 };
+	}
+
+	LOG(ll_vvv) << (args.all ? "wait_all" : "wait_any") << ": conditions=" << count;
+
+	// A condition counts as met once it has been observed; only the
+	// outstanding ones are read again
+	uint64_t pending = (count == 64) ? ~0ULL : ((1ULL << count) - 1);
+	uint64_t fired = 0;
+	bool all = args.all;
+
+	poll_result result = poll_until([&]() {
+		for (uint64_t bits = pending; bits != 0; bits &= bits - 1) {
+			int i = __builtin_ctzll(bits);
+			uint64_t value = memory_read(watches[i].ptr, watches[i].width);
+			trace_poll_sample(watches[i].trace_state, watches[i].region, watches[i].offset, watches[i].width, value);
+			if (((value & watches[i].mask) > 0) == watches[i].condition) {
+				fired |= (1ULL << i);
 			}
 		}
+		pending &= ~fired;
+		return all ? (pending == 0) : (fired != 0);
+	}, args.timeout_ns, args.poll);
 
-		auto now = std::chrono::high_resolution_clock::now();
-		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - mark);
+	for (uint32_t i=0; i < count; ++i) {
+		trace_poll_finish(watches[i].trace_state, watches[i].region, watches[i].offset, watches[i].width);
+	}
 
-		if (elapsed.count() > timeout) {
-			LOG(ll_v) << "timeout reached while polling value";
-			break;
+	if (!result.satisfied) {
+		LOG(ll_v) << "timeout reached while waiting";
+	}
+
+	LOG(ll_vv) << (args.all ? "wait_all" : "wait_any") << ": fired=" << std::hex << fired << std::dec << ", iterations=" << result.iterations << ", latency=" << result.elapsed_ns / 1000 << "us";
+
+	if (args.fired_variable != no_slot) {
+		script_context.set_variable(args.fired_variable, fired);
+	}
+
+	if (args.elapsed_variable != no_slot) {
+		script_context.set_variable(args.elapsed_variable, result.elapsed_ns / 1000);
+	}
+}
+
+static void cmd_dump_memory(const program& program, const instruction& instruction, script_context& script_context)
+{
+	const dump_memory_args& args(instruction.dump_memory);
+	memory_region* memory_region = script_context.get_memory_region(args.region);
+	uint64_t offset = expression_evaluate(program, args.offset, script_context);
+	uint64_t size = expression_evaluate(program, args.size, script_context);
+	const std::string& file(program.strings[args.file]);
+
+	LOG(ll_vvv) << "dump_memory: memory_region=" << memory_region->name() << ", offset=" << std::hex << offset << ", size=" << size << ", file=" << file;
+
+	check_range(memory_region, offset, size);
+
+	int fd = open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		throw script_exception(fmt() << "could not open " << file << ": " << strerror(errno));
+	}
+
+	// Write straight from the mapping in large chunks. vmsplice is not an
+	// option here, since the kernel cannot pin pages of /dev/mem mappings.
+	const uint64_t chunk_size = 16 * 1024 * 1024;
+	const uint8_t* ptr = (const uint8_t*)memory_region->mapped_address() + offset;
+	uint64_t start = monotonic_ns();
+	uint64_t written = 0;
+
+	while (written < size) {
+		ssize_t result = write(fd, ptr + written, std::min(chunk_size, size - written));
+		if (result < 0 && errno == EINTR) {
+			continue;
+		}
+		if (result <= 0) {
+			int error = errno;
+			close(fd);
+			throw script_exception(fmt() << "could not write " << file << ": " << strerror(error));
 		}
+		written += result;
+	}
 
-		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	if (close(fd) != 0) {
+		throw script_exception(fmt() << "could not write " << file << ": " << strerror(errno));
+	}
 
-	} while (((value & mask) > 0) != condition);
+	log_throughput("dump_memory", size, monotonic_ns() - start);
 }
 
-static void cmd_delay(const Json::Value& script, script_context& script_context)
+static void cmd_load_memory(const program& program, const instruction& instruction, script_context& script_context)
 {
-	int s = script["s"].asInt();
-	int ms = script["ms"].asInt();
-	int us = script["us"].asInt();
+	const load_memory_args& args(instruction.load_memory);
+	memory_region* memory_region = script_context.get_memory_region(args.region);
+	uint64_t offset = expression_evaluate(program, args.offset, script_context);
+	const std::string& file(program.strings[args.file]);
+	const uint64_t element_size = args.width / 8;
 
-	us += ms * 1000;
-	us += s * 1000 * 1000;
+	LOG(ll_vvv) << "load_memory: memory_region=" << memory_region->name() << ", offset=" << std::hex << offset << ", file=" << file;
+
+	int fd = open(file.c_str(), O_RDONLY);
+	if (fd == -1) {
+		throw script_exception(fmt() << "could not open " << file << ": " << strerror(errno));
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		int error = errno;
+		close(fd);
+		throw script_exception(fmt() << "could not stat " << file << ": " << strerror(error));
+	}
+
+	uint64_t size = st.st_size;
+	if (size % element_size != 0 || offset % element_size != 0) {
+		close(fd);
+		throw script_exception(fmt() << "load_memory: file size and offset must be multiples of the " << std::dec << args.width << " bit width");
+	}
 
-	LOG(ll_vvv) << "delay: us=" << us;
+	try {
+		check_range(memory_region, offset, size);
+	} catch (...) {
+		close(fd);
+		throw;
+	}
+
+	if (size == 0) {
+		close(fd);
+		return;
+	}
+
+	const uint8_t* source = (const uint8_t*)mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (source == MAP_FAILED) {
+		throw script_exception(fmt() << "could not map " << file << ": " << strerror(errno));
+	}
+	madvise((void*)source, size, MADV_SEQUENTIAL);
+
+	// Copy in chunks and drop each chunk of the file mapping once it has
+	// been copied, so loading a large image does not pin it all at once.
+	const uint64_t chunk_size = 16 * 1024 * 1024;
+	uint8_t* destination = (uint8_t*)memory_region->mapped_address() + offset;
+	uint64_t start = monotonic_ns();
+
+	for (uint64_t done = 0; done < size; ) {
+		uint64_t length = std::min(chunk_size, size - done);
+		bulk_copy(destination + done, source + done, memory_region->address() + offset + done, args.width, length / element_size, args.access);
+		madvise((void*)(source + done), length, MADV_DONTNEED);
+		done += length;
+	}
 
-	std::this_thread::sleep_for(std::chrono::microseconds(us));
+	log_throughput("load_memory", size, monotonic_ns() - start);
+	munmap((void*)source, size);
 }
 
-static void cmd_print(const Json::Value& script, script_context& script_context)
+static void cmd_copy_memory(const program& program, const instruction& instruction, script_context& script_context)
 {
-	std::string message = script["message"].asString();
-	Json::Value arguments(script["arguments"]);
+	const copy_memory_args& args(instruction.copy_memory);
+	memory_region* source = script_context.get_memory_region(args.source_region);
+	memory_region* destination = script_context.get_memory_region(args.destination_region);
+	uint64_t source_offset = expression_evaluate(program, args.source_offset, script_context);
+	uint64_t destination_offset = expression_evaluate(program, args.destination_offset, script_context);
+	uint64_t size = expression_evaluate(program, args.size, script_context);
+	const uint64_t element_size = args.width / 8;
+
+	LOG(ll_vvv) << "copy_memory: source_region=" << source->name() << ", source_offset=" << std::hex << source_offset
+		<< ", destination_region=" << destination->name() << ", destination_offset=" << destination_offset << ", size=" << size;
+
+	if (size % element_size != 0 || source_offset % element_size != 0 || destination_offset % element_size != 0) {
+		throw script_exception(fmt() << "copy_memory: size and offsets must be multiples of the " << std::dec << args.width << " bit width");
+	}
 
-	if (!arguments.isArray()) {
-		throw script_exception("print arguments must be an array");
+	check_range(source, source_offset, size);
+	check_range(destination, destination_offset, size);
+
+	uint64_t start = monotonic_ns();
+	bulk_move((uint8_t*)destination->mapped_address() + destination_offset, (const uint8_t*)source->mapped_address() + source_offset,
+		destination->address() + destination_offset, source->address() + source_offset, args.width, size / element_size, args.access);
+	log_throughput("copy_memory", size, monotonic_ns() - start);
+}
+
+static void cmd_checksum_memory(const program& program, const instruction& instruction, script_context& script_context)
+{
+	const checksum_memory_args& args(instruction.checksum_memory);
+	memory_region* memory_region = script_context.get_memory_region(args.region);
+	uint64_t offset = expression_evaluate(program, args.offset, script_context);
+	uint64_t size = expression_evaluate(program, args.size, script_context);
+
+	LOG(ll_vvv) << "checksum_memory: memory_region=" << memory_region->name() << ", offset=" << std::hex << offset << ", size=" << size;
+
+	check_range(memory_region, offset, size);
+
+	uint64_t start = monotonic_ns();
+	uint64_t checksum = checksum_compute(args.algorithm, (const uint8_t*)memory_region->mapped_address() + offset, size);
+	log_throughput("checksum_memory", size, monotonic_ns() - start);
+
+	LOG(ll_v) << "checksum_memory: " << memory_region->name() << "+0x" << std::hex << offset << ": 0x" << checksum;
+
+	if (args.variable != no_slot) {
+		script_context.set_variable(args.variable, checksum);
 	}
 
-	for (Json::ArrayIndex i=0; i < arguments.size(); ++i) {
-		uint64_t value = expression_process(arguments[i], script_context);
-		std::string text = (fmt() << std::hex << value);
-		std::string placeholder = (fmt() << "{" << i + 1 << "}");
+	if (args.check) {
+		uint64_t value = expression_evaluate(program, args.value, script_context);
+		if ((checksum == value) != args.condition) {
+			throw script_exception(fmt() << "checksum assertion failed: 0x" << std::hex << checksum << (args.condition ? " != 0x" : " == 0x") << value);
+		}
+	}
+}
 
-		size_t start_pos = message.find(placeholder);
-		if(start_pos == std::string::npos) {
-			throw script_exception("could not find string placeholder");
+static void cmd_memtest(const program& program, const instruction& instruction, script_context& script_context)
+{
+	const memtest_args& args(instruction.memtest);
+	memory_region* memory_region = script_context.get_memory_region(args.region);
+	uint64_t offset = expression_evaluate(program, args.offset, script_context);
+	uint64_t size = expression_evaluate(program, args.size, script_context);
+	uint64_t seed = expression_evaluate(program, args.seed, script_context);
+	const uint64_t element_size = args.width / 8;
+	const char* pattern = memtest_pattern_names[args.pattern];
+
+	LOG(ll_vvv) << "memtest: memory_region=" << memory_region->name() << ", offset=" << std::hex << offset << ", size=" << size << ", pattern=" << pattern;
+
+	if (size % element_size != 0 || offset % element_size != 0) {
+		throw script_exception(fmt() << "memtest: size and offset must be multiples of the " << std::dec << args.width << " bit width");
+	}
+
+	check_range(memory_region, offset, size);
+
+	memtest_result result;
+	uint64_t start = monotonic_ns();
+	memtest_run((uint8_t*)memory_region->mapped_address() + offset, memory_region->address() + offset, args.width, size / element_size,
+		args.pattern, seed, args.access, args.max_failures, result);
+	log_throughput("memtest", size * result.passes, monotonic_ns() - start);
+
+	if (args.error_variable != no_slot) {
+		script_context.set_variable(args.error_variable, result.error_count);
+	}
+
+	if (result.error_count == 0) {
+		return;
+	}
+
+	for (const memtest_failure& failure : result.failures) {
+		uint64_t failure_offset = offset + failure.index * element_size;
+
+		switch (output_get_format()) {
+			case output_text: {
+				output_write("At offset 0x");
+				output_write_hex(failure_offset);
+				output_write(", pass ");
+				output_write_dec(failure.pass);
+				output_write(", expected 0x");
+				output_write_hex(failure.expected);
+				output_write(", got 0x");
+				output_write_hex(failure.actual);
+			} break;
+			case output_jsonl: {
+				output_write("{\"command\":\"memtest\",\"memory_region\":");
+				output_write_json_string(memory_region->name());
+				output_write(",\"offset\":\"0x");
+				output_write_hex(failure_offset);
+				output_write("\",\"pass\":");
+				output_write_dec(failure.pass);
+				output_write(",\"expected\":\"0x");
+				output_write_hex(failure.expected);
+				output_write("\",\"actual\":\"0x");
+				output_write_hex(failure.actual);
+				output_write("\"}");
+			} break;
+			case output_csv: {
+				output_write("memtest,");
+				output_write_csv_string(memory_region->name());
+				output_write(",0x");
+				output_write_hex(failure_offset);
+				output_write(',');
+				output_write_dec(failure.pass);
+				output_write(",0x");
+				output_write_hex(failure.expected);
+				output_write(",0x");
+				output_write_hex(failure.actual);
+			} break;
 		}
 
-		message.replace(start_pos, placeholder.length(), text);
+		output_write('\n');
 	}
 
-	std::cout << message << std::endl;
+	if (output_get_format() == output_text) {
+		output_write("memtest: ");
+		output_write(pattern);
+		output_write(": ");
+		output_write_dec(result.error_count);
+		output_write(" errors in ");
+		output_write_dec(result.passes);
+		output_write(" passes, failing bits 0x");
+		output_write_hex(result.failing_bits);
+		output_write('\n');
+	}
 }
 
-static void cmd_assert(const Json::Value& script, script_context& script_context)
+static void cmd_block(const program& program, const instruction& instruction, script_context& script_context)
 {
-	uint64_t variable = expression_process(script["variable"], script_context);
-	uint64_t value = expression_process(script["value"], script_context);
-	bool condition = script["condition"].asBool();
+	auto begin = &instruction + 1;
+	execute_block(program, begin, begin + instruction.block_size, script_context);
+}
 
-	LOG(ll_vvv) << "assert: variable="<<  std::hex << variable << ", value=" << std::hex << value;
+static void cmd_parallel(const program& program, const instruction& instruction, script_context& script_context)
+{
+	auto begin = &instruction + 1;
+	auto end = begin + instruction.block_size;
 
-	if ((variable == value) != condition) {
-		throw script_exception("assertion failed");
+	std::vector<const struct instruction*> blocks;
+	for (auto i = begin; i != end; i += 1 + i->block_size) {
+		blocks.push_back(i);
+	}
+
+	LOG(ll_vvv) << "parallel: blocks=" << blocks.size();
+
+	std::vector<std::string> outputs(blocks.size());
+	std::vector<std::exception_ptr> errors(blocks.size());
+	std::vector<std::thread> threads;
+
+	for (size_t i=0; i < blocks.size(); ++i) {
+		threads.push_back(std::thread([&, i] {
+			output_capture(&outputs[i]);
+			try {
+				struct script_context block_context(&script_context);
+				cmd_block(program, *blocks[i], block_context);
+			} catch (...) {
+				errors[i] = std::current_exception();
+			}
+			output_capture(nullptr);
+		}));
+	}
+
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+
+	// Output appears in block order, whatever order the blocks ran in
+	for (const std::string& output : outputs) {
+		output_write(output);
+	}
+
+	for (size_t i=0; i < blocks.size(); ++i) {
+		if (errors[i]) {
+			try {
+				std::rethrow_exception(errors[i]);
+			} catch (std::exception& e) {
+				throw script_exception(fmt() << "parallel block " << i << ": " << e.what());
+			}
+		}
 	}
 }
 
-static void cmd_compare_memory(const Json::Value& script, script_context& script_context)
+
+// Checks a program against the sizes of its sections and the bound slots
+class program_checker
 {
-	memory_region* memory_region = script_context.get_memory_region(script["memory_region"].asString());
-	uint64_t offset = expression_process(script["offset"].asString(), script_context);
-	int width = script["width"].asInt();
-	uint64_t value = expression_process(script["value"], script_context);
-	int count = script.get("count", 1).asInt();
-	uint64_t value_increment = expression_process(script.get("value_increment", "0"), script_context);
-	int max_error_count = script.get("max_error_count", 1).asInt();
+public:
+	program_checker(const program& program, uint32_t region_count, uint32_t variable_count) :
+		_program(program),
+		_region_count(region_count),
+		_variable_count(variable_count)
+	{
 
-	if (memory_region == nullptr) {
-		throw script_exception(fmt() << "memory region " << script["memory_region"].asString() << " not found");
 	}
 
-	LOG(ll_vvv) << "compare_memory: memory_region=" << memory_region->name() << ", offset=" << std::hex << offset << ", count=" << count << ", value_increment=" << std::hex << value_increment;
+	void check_block(uint64_t begin, uint64_t end, uint16_t parent)
+	{
+		for (uint64_t i = begin; i < end; i += 1 + _program.instructions[i].block_size) {
+			const instruction& instruction(_program.instructions[i]);
 
-	uint64_t read_value = 0;
-	int error_count = 0;
+			if (instruction.op >= op_count || (instruction.op == op_block) != (parent == op_parallel)) {
+				throw script_exception(fmt() << "invalid opcode " << instruction.op << " at instruction " << i);
+			}
 
-	switch (width) {
-		case 8: {
-			uint8_t* ptr = (uint8_t*)((uint8_t*)memory_region->mapped_address() + offset);
-			for (int i=0; i < count; ++i) {
-				read_value = *ptr++;
-				if (read_value != value) {
-					std::cout << "At offset " << offset << " (" << std::hex << offset << "), expected 0x" << std::hex << value << ", got 0x" << std::hex << read_value << std::endl;
-					error_count++;
-					if (error_count >= max_error_count) {
-						return;
-					}
-				}
-				offset += width / 8;
-				value += value_increment;
+			if (instruction.block_size > end - i - 1) {
+				throw script_exception(fmt() << "invalid block size at instruction " << i);
 			}
-		} break;
-		case 16: {
-			uint16_t* ptr = (uint16_t*)((uint8_t*)memory_region->mapped_address() + offset);
-			for (int i=0; i < count; ++i) {
-				read_value = *ptr++;
-				if (read_value != value) {
-					std::cout << "At offset " << offset << " (" << std::hex << offset << "), expected 0x" << std::hex << value << ", got 0x" << std::hex << read_value << std::endl;
-					error_count++;
-					if (error_count >= max_error_count) {
-						return;
-					}
-				}
-				offset += width / 8;
-				value += value_increment;
+
+			if (instruction.op == op_repeat || instruction.op == op_parallel || instruction.op == op_block) {
+				check_block(i + 1, i + 1 + instruction.block_size, instruction.op);
+			} else if (instruction.block_size != 0) {
+				throw script_exception(fmt() << "invalid block size at instruction " << i);
 			}
-		} break;
-		case 32: {
-			uint32_t* ptr = (uint32_t*)((uint8_t*)memory_region->mapped_address() + offset);
-			for (int i=0; i < count; ++i) {
-				read_value = *ptr++;
-				if (read_value != value) {
-					std::cout << "At offset " << offset << " (" << std::hex << offset << "), expected 0x" << std::hex << value << ", got 0x" << std::hex << read_value << std::endl;
-					error_count++;
-					if (error_count >= max_error_count) {
-						return;
-					}
+
+			check_instruction(instruction);
+		}
+	}
+
+	void check_arguments()
+	{
+		for (const operand& argument : _program.arguments) {
+			expression_validate(_program, argument, _variable_count);
+		}
+	}
+
+private:
+	static void check(bool condition, const char* what)
+	{
+		if (!condition) {
+			throw script_exception(fmt() << "invalid " << what);
+		}
+	}
+
+	static void check_range(uint64_t first, uint64_t count, uint64_t size, const char* what)
+	{
+		check(first <= size && count <= size - first, what);
+	}
+
+	void check_region(uint32_t slot) { check(slot < _region_count, "memory region slot"); }
+	void check_variable(uint32_t slot) { check(slot < _variable_count, "variable slot"); }
+	void check_optional_variable(uint32_t slot) { check(slot == no_slot || slot < _variable_count, "variable slot"); }
+	void check_string(string_ref ref) { check(ref < _program.strings.size(), "string index"); }
+	void check_operand(const operand& operand) { expression_validate(_program, operand, _variable_count); }
+	void check_poll(const poll_options& poll) { check(poll.strategy <= poll_sleep, "poll strategy"); }
+	void check_access(access_mode access) { check(access <= access_exact, "access mode"); }
+
+	static void check_width(uint32_t width)
+	{
+		check(width == 8 || width == 16 || width == 32 || width == 64, "data width");
+	}
+
+	void check_instruction(const instruction& instruction)
+	{
+		switch (instruction.op) {
+			case op_set_config: {
+				const set_config_args& args(instruction.set_config);
+				check(args.option <= config_cpus, "configuration option");
+				if (args.option == config_output_format) {
+					check(args.value >= output_text && args.value <= output_csv, "output format");
+				} else if (args.option == config_cpus) {
+					check(args.value >= 0 && (uint64_t)args.value < _program.strings.size(), "string index");
 				}
-				offset += width / 8;
-				value += value_increment;
-			}
-		} break;
-		case 64: {
-			uint64_t* ptr = (uint64_t*)((uint8_t*)memory_region->mapped_address() + offset);
-			for (int i=0; i < count; ++i) {
-				read_value = *ptr++;
-				if (read_value != value) {
-					std::cout << "At offset " << offset << " (" << std::hex << offset << "), expected 0x" << std::hex << value << ", got 0x" << std::hex << read_value << std::endl;
-					error_count++;
-					if (error_count >= max_error_count) {
-						return;
+			} break;
+			case op_declare_memory_region: {
+				check_region(instruction.declare_memory_region.region);
+				check(instruction.declare_memory_region.options.advice <= advice_willneed, "mapping advice");
+			} break;
+			case op_set_variable: {
+				check_variable(instruction.set_variable.variable);
+				check_operand(instruction.set_variable.value);
+			} break;
+			case op_write_value: {
+				const write_value_args& args(instruction.write_value);
+				check_region(args.region);
+				check_width(args.width);
+				check_operand(args.offset);
+				check_operand(args.value);
+				check_operand(args.value_increment);
+				check_access(args.access);
+			} break;
+			case op_read_value: {
+				const read_value_args& args(instruction.read_value);
+				check_region(args.region);
+				check_width(args.width);
+				check_operand(args.offset);
+				check_optional_variable(args.variable);
+				check_string(args.display_prefix);
+			} break;
+			case op_poll_value: {
+				const poll_value_args& args(instruction.poll_value);
+				check_region(args.region);
+				check_width(args.width);
+				check_operand(args.offset);
+				check_operand(args.mask);
+				check_poll(args.poll);
+			} break;
+			case op_print: {
+				const print_args& args(instruction.print);
+				check_range(args.first_segment, args.segment_count, _program.print_segments.size(), "print segment range");
+				check_range(args.first_argument, args.argument_count, _program.arguments.size(), "print argument range");
+				for (uint32_t i=0; i < args.segment_count; ++i) {
+					const print_segment& segment(_program.print_segments[args.first_segment + i]);
+					if (segment.argument == no_slot) {
+						check_string(segment.text);
+					} else {
+						check(segment.argument < args.argument_count, "print argument");
+						check(segment.base >= 2 && segment.base <= 16 && segment.width <= 64, "print format");
 					}
 				}
-				offset += width / 8;
-				value += value_increment;
-			}
-		} break;
-		default: {
-			throw script_exception(fmt() << "invalid data width: " << width);
+			} break;
+			case op_assert: {
+				check_operand(instruction.assertion.variable);
+				check_operand(instruction.assertion.value);
+			} break;
+			case op_compare_memory: {
+				const compare_memory_args& args(instruction.compare_memory);
+				check_region(args.region);
+				check_width(args.width);
+				check_operand(args.offset);
+				check_operand(args.value);
+				check_operand(args.value_increment);
+				check_operand(args.mask);
+				check_access(args.access);
+				check_optional_variable(args.error_variable);
+				check_optional_variable(args.range_variable);
+			} break;
+			case op_repeat: {
+				const repeat_args& args(instruction.repeat);
+				check_optional_variable(args.variable);
+				check_operand(args.count);
+				check_operand(args.start);
+				check_operand(args.step);
+			} break;
+			case op_wait: {
+				const wait_args& args(instruction.wait);
+				check(args.condition_count >= 1 && args.condition_count <= 64, "wait condition count");
+				check_range(args.first_condition, args.condition_count, _program.wait_conditions.size(), "wait condition range");
+				for (uint32_t i=0; i < args.condition_count; ++i) {
+					const wait_condition& condition(_program.wait_conditions[args.first_condition + i]);
+					check_region(condition.region);
+					check_width(condition.width);
+					check_operand(condition.offset);
+					check_operand(condition.mask);
+				}
+				check_optional_variable(args.fired_variable);
+				check_optional_variable(args.elapsed_variable);
+				check_poll(args.poll);
+			} break;
+			case op_dump_memory: {
+				const dump_memory_args& args(instruction.dump_memory);
+				check_region(args.region);
+				check_operand(args.offset);
+				check_operand(args.size);
+				check_string(args.file);
+			} break;
+			case op_load_memory: {
+				const load_memory_args& args(instruction.load_memory);
+				check_region(args.region);
+				check_operand(args.offset);
+				check_string(args.file);
+				check_width(args.width);
+				check_access(args.access);
+			} break;
+			case op_copy_memory: {
+				const copy_memory_args& args(instruction.copy_memory);
+				check_region(args.source_region);
+				check_region(args.destination_region);
+				check_operand(args.source_offset);
+				check_operand(args.destination_offset);
+				check_operand(args.size);
+				check_width(args.width);
+				check_access(args.access);
+			} break;
+			case op_checksum_memory: {
+				const checksum_memory_args& args(instruction.checksum_memory);
+				check_region(args.region);
+				check_operand(args.offset);
+				check_operand(args.size);
+				check(args.algorithm <= checksum_xxh64, "checksum algorithm");
+				check_optional_variable(args.variable);
+				check_operand(args.value);
+			} break;
+			case op_memtest: {
+				const memtest_args& args(instruction.memtest);
+				check_region(args.region);
+				check_operand(args.offset);
+				check_operand(args.size);
+				check_width(args.width);
+				check(args.pattern <= memtest_lfsr, "memtest pattern");
+				check_operand(args.seed);
+				check_access(args.access);
+				check_optional_variable(args.error_variable);
+			} break;
+			default:
+				break;
 		}
 	}
+
+	const program& _program;
+	uint32_t _region_count;
+	uint32_t _variable_count;
+};
+
+void program_validate(const program& program, uint32_t region_count, uint32_t variable_count)
+{
+	if (!program.locations.empty() && program.locations.size() != program.instructions.size()) {
+		throw script_exception("invalid location count");
+	}
+
+	program_checker checker(program, region_count, variable_count);
+	checker.check_block(0, program.instructions.size(), op_count);
+	checker.check_arguments();
 }
@@ -25,11 +25,20 @@
 
 
 #include "script_context.h"
+#include "program.h"
 #include <jsoncpp/json/json.h>
 
 
 void commands_init();
+void command_compile(const Json::Value& script, program& program, script_context& script_context);
+void program_execute(const program& program, script_context& script_context);
 void command_process(const Json::Value& script, script_context& script_context);
 
+const char* opcode_name(uint16_t op);
+
+// Checks every index, range and enumeration of a program that did not come
+// from command_compile, such as one loaded from the program cache
+void program_validate(const program& program, uint32_t region_count, uint32_t variable_count);
+
 
 #endif
@@ -0,0 +1,277 @@
+/*
+	Copyright (c) 2017 Willem Kemp
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#include "daemon.h"
+#include "commands.h"
+#include "output.h"
+#include "logging.h"
+#include "script_exception.h"
+
+#include <jsoncpp/json/json.h>
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <unordered_map>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+// Requests larger than this are refused
+static const size_t max_request_size = 16 * 1024 * 1024;
+
+// Compiled programs are cached by script text, up to this many
+static const size_t max_cached_programs = 256;
+
+// A client that sends or accepts nothing for this long is dropped, so an
+// idle connection cannot hold up the requests queued behind it
+static const int client_timeout_s = 5;
+
+// How deep { "run": file } requests may refer to further files
+static const int max_run_depth = 8;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+// Compiled request programs. Variables the programs bound are forgotten
+// with them, down to the ones bound by the startup script.
+struct request_cache
+{
+	std::unordered_map<std::string, std::unique_ptr<program>> programs;
+	uint32_t base_variable_count;
+};
+
+
+static void handle_stop(int)
+{
+	stop_requested = 1;
+}
+
+static bool read_request(int fd, std::string& request)
+{
+	char buffer[65536];
+
+	while (true) {
+		ssize_t result = read(fd, buffer, sizeof(buffer));
+		if (result < 0 && errno == EINTR) {
+			continue;
+		}
+		if (result <= 0) {
+			return result == 0;
+		}
+
+		request.append(buffer, result);
+		if (request.size() > max_request_size) {
+			return false;
+		}
+	}
+}
+
+static void write_response(int fd, const std::string& response)
+{
+	size_t written = 0;
+
+	while (written < response.size()) {
+		ssize_t result = write(fd, response.data() + written, response.size() - written);
+		if (result < 0 && errno == EINTR) {
+			continue;
+		}
+		if (result <= 0) {
+			break;
+		}
+		written += result;
+	}
+}
+
+static std::string read_file(const std::string& name)
+{
+	std::ifstream file(name);
+	if (!file) {
+		throw script_exception(fmt() << "could not open " << name);
+	}
+
+	std::stringstream text;
+	text << file.rdbuf();
+	return text.str();
+}
+
+// Regions and configuration are process wide and set up by the startup
+// script. Returns the first command in script that would change them, or
+// nullptr. Checked before compiling, which would already bind the region.
+static const char* find_setup_command(const Json::Value& script)
+{
+	if (script.isObject()) {
+		if (script["command"] == "declare_memory_region") {
+			return "declare_memory_region";
+		}
+		if (script["command"] == "set_config") {
+			return "set_config";
+		}
+	}
+
+	if (script.isObject() || script.isArray()) {
+		for (const Json::Value& child : script) {
+			const char* command = find_setup_command(child);
+			if (command) {
+				return command;
+			}
+		}
+	}
+
+	return nullptr;
+}
+
+// Returns the program for the script in text, compiling it on first use.
+// Programs stay valid while they are cached, since only clearing the cache
+// unbinds the slots they use.
+static const program& compile_request(std::string text, script_context& script_context, request_cache& cache, int depth = 0)
+{
+	auto i = cache.programs.find(text);
+	if (i != cache.programs.end()) {
+		return *i->second;
+	}
+
+	Json::Value root;
+	Json::Reader reader;
+	if (!reader.parse(text, root)) {
+		throw script_exception(reader.getFormattedErrorMessages());
+	}
+
+	if (root.isObject() && root.isMember("run")) {
+		if (depth >= max_run_depth) {
+			throw script_exception(fmt() << "run requests nested deeper than " << max_run_depth);
+		}
+		std::string file = read_file(root["run"].asString());
+		return compile_request(file, script_context, cache, depth + 1);
+	}
+
+	const char* setup_command = find_setup_command(root);
+	if (setup_command) {
+		throw script_exception(fmt() << setup_command << " is not allowed in daemon requests");
+	}
+
+	if (cache.programs.size() >= max_cached_programs) {
+		cache.programs.clear();
+		script_context.unbind_variables(cache.base_variable_count);
+	}
+
+	// A request that fails to compile leaves no variables behind
+	uint32_t variable_count = script_context.variable_count();
+	std::unique_ptr<program> compiled(new program());
+	try {
+		command_compile(root, *compiled, script_context);
+	} catch (...) {
+		script_context.unbind_variables(variable_count);
+		throw;
+	}
+
+	const program& result = *compiled;
+	cache.programs[text] = std::move(compiled);
+	return result;
+}
+
+static void serve(int client, script_context& script_context, request_cache& cache)
+{
+	std::string request;
+	std::string output;
+	std::string status = "ok\n";
+
+	if (!read_request(client, request)) {
+		write_response(client, "error: could not read request\n");
+		return;
+	}
+
+	output_capture(&output);
+	try {
+		const program& program = compile_request(request, script_context, cache);
+
+		// Every request gets its own copy of the variables
+		struct script_context request_context(&script_context);
+		program_execute(program, request_context);
+
+	} catch (std::exception& e) {
+		status = fmt() << "error: " << e.what() << "\n";
+	}
+	output_capture(nullptr);
+
+	write_response(client, status + output);
+}
+
+void daemon_run(const std::string& socket_path, script_context& script_context)
+{
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+
+	if (socket_path.size() >= sizeof(address.sun_path)) {
+		throw script_exception(fmt() << "socket path too long: " << socket_path);
+	}
+	strcpy(address.sun_path, socket_path.c_str());
+
+	int server = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (server == -1) {
+		throw script_exception(fmt() << "could not create socket: " << strerror(errno));
+	}
+
+	unlink(socket_path.c_str());
+	if (bind(server, (sockaddr*)&address, sizeof(address)) == -1 || listen(server, 64) == -1) {
+		int error = errno;
+		close(server);
+		throw script_exception(fmt() << "could not listen on " << socket_path << ": " << strerror(error));
+	}
+
+	// Without SA_RESTART, a signal interrupts accept and ends the loop
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = handle_stop;
+	sigaction(SIGINT, &action, nullptr);
+	sigaction(SIGTERM, &action, nullptr);
+	signal(SIGPIPE, SIG_IGN);
+
+	LOG(ll_v) << "daemon: listening on " << socket_path;
+
+	request_cache cache;
+	cache.base_variable_count = script_context.variable_count();
+
+	while (!stop_requested) {
+		int client = accept4(server, nullptr, nullptr, SOCK_CLOEXEC);
+		if (client == -1) {
+			continue;
+		}
+
+		timeval timeout = { client_timeout_s, 0 };
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+		serve(client, script_context, cache);
+		close(client);
+	}
+
+	LOG(ll_v) << "daemon: stopping";
+
+	close(server);
+	unlink(socket_path.c_str());
+}
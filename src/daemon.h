@@ -20,18 +20,20 @@
 	SOFTWARE.
 */
 
-#include "memory_region.h"
+#ifndef DAEMON_H
+#define DAEMON_H
 
+#include "script_context.h"
 
-memory_region::memory_region(const std::string& name, uint64_t address, uint64_t size) :
-	_name(name),
-	_address(address),
-	_size(size)
-{
-	_mapped_address = malloc(size);
-}
+#include <string>
 
-memory_region::~memory_region()
-{
-	free(_mapped_address);
-}
+
+// Serves scripts on a Unix socket until SIGINT or SIGTERM, keeping
+// script_context and its mapped regions alive between requests. A client
+// sends a script, or {"run": "file"} to run a script file, and shuts down
+// its side of the connection. The daemon answers with a status line, "ok"
+// or "error: <message>", followed by the script output.
+void daemon_run(const std::string& socket_path, script_context& script_context);
+
+
+#endif
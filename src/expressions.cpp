@@ -22,96 +22,264 @@
 
 #include "expressions.h"
 #include "script_exception.h"
+#include "textutils.h"
 
-static uint64_t script_operator_and(const Json::Value& opr, script_context& script_context);
-static uint64_t script_operator_or(const Json::Value& opr, script_context& script_context);
-static uint64_t script_operator_not(const Json::Value& opr, script_context& script_context);
-static uint64_t script_operator_shl(const Json::Value& opr, script_context& script_context);
-static uint64_t script_operator_shr(const Json::Value& opr, script_context& script_context);
+#include <cstring>
 
 
+// Deepest value stack an expression may need at run time
+static const size_t max_stack_depth = 64;
+
+
+struct operator_info
+{
+	expression_opcode code;
+	expression_opcode immediate_code;
+	bool unary;
+};
+
+static std::map<std::string, operator_info> operator_map;
+
+
+static uint64_t apply_operator(uint16_t code, uint64_t left, uint64_t right);
+static void compile_node(const Json::Value& value, std::vector<expression_op>& code, program& program, script_context& script_context);
+static size_t stack_depth(const std::vector<expression_op>& code);
 
-typedef uint64_t (*operator_callback_t)(const Json::Value& opr, script_context& script_context);
-static std::map<std::string, operator_callback_t> operator_map;
 
 
 void expressions_init()
 {
-	operator_map["and"] = script_operator_and;
-	operator_map["or"] = script_operator_or;
-	operator_map["not"] = script_operator_not;
-	operator_map["shl"] = script_operator_shl;
-	operator_map["shr"] = script_operator_shr;
+	operator_map["and"] = { eop_and, eop_and_immediate, false };
+	operator_map["or"] = { eop_or, eop_or_immediate, false };
+	operator_map["not"] = { eop_not, eop_not, true };
+	operator_map["shl"] = { eop_shl, eop_shl_immediate, false };
+	operator_map["shr"] = { eop_shr, eop_shr_immediate, false };
 }
 
-uint64_t expression_process(const Json::Value& value, script_context& script_context)
+operand expression_compile(const Json::Value& value, program& program, script_context& script_context)
 {
-	if (value.isString()) {
-		return script_context.resolve_value(value.asString());
+	std::vector<expression_op> code;
+	compile_node(value, code, program, script_context);
 
-	} else if (value.isObject()) {
-		std::string opr = value["operator"].asString();
-		auto i = operator_map.find(opr);
-		if (i == operator_map.end()) {
-			throw script_exception(fmt() << "unknown operator: " << opr);
-		} else {
-			return ((*i).second)(value, script_context);
-		}
+	operand result;
+	result.index = 0;
+	result.value = 0;
+
+	if (code.size() == 1 && code[0].code == eop_constant) {
+		result.kind = operand_constant;
+		result.value = code[0].value;
+
+	} else if (code.size() == 1 && code[0].code == eop_variable) {
+		result.kind = operand_variable;
+		result.index = code[0].index;
 
 	} else {
-		throw script_exception("invalid value type");
+		if (stack_depth(code) > max_stack_depth) {
+			throw script_exception("expression too deeply nested");
+		}
+
+		result.kind = operand_expression;
+		result.index = program.expression_code.size();
+		result.value = code.size();
+		program.expression_code.insert(program.expression_code.end(), code.begin(), code.end());
 	}
+
+	return result;
 }
 
-static uint64_t script_operator_and(const Json::Value& opr, script_context& script_context)
+uint64_t expression_run(const program& program, const operand& operand, const script_context& script_context)
 {
-	const Json::Value& left_obj(opr["left"]);
-	const Json::Value& right_obj(opr["right"]);
+	uint64_t stack[max_stack_depth];
+	size_t sp = 0;
+
+	const expression_op* op = &program.expression_code[operand.index];
+	const expression_op* end = op + operand.value;
 
-	uint64_t left = expression_process(left_obj, script_context);
-	uint64_t right = expression_process(right_obj, script_context);
+	for (; op != end; ++op) {
+		switch (op->code) {
+			case eop_constant: stack[sp++] = op->value; break;
+			case eop_variable: stack[sp++] = script_context.get_variable(op->index); break;
+			case eop_and: --sp; stack[sp - 1] &= stack[sp]; break;
+			case eop_or: --sp; stack[sp - 1] |= stack[sp]; break;
+			case eop_not: stack[sp - 1] = ~stack[sp - 1]; break;
+			case eop_shl: --sp; stack[sp - 1] <<= stack[sp]; break;
+			case eop_shr: --sp; stack[sp - 1] >>= stack[sp]; break;
+			case eop_and_immediate: stack[sp - 1] &= op->value; break;
+			case eop_or_immediate: stack[sp - 1] |= op->value; break;
+			case eop_shl_immediate: stack[sp - 1] <<= op->value; break;
+			case eop_shr_immediate: stack[sp - 1] >>= op->value; break;
+		}
+	}
 
-	return (left & right);
+	return stack[0];
 }
 
-static uint64_t script_operator_or(const Json::Value& opr, script_context& script_context)
-{
-	const Json::Value& left_obj(opr["left"]);
-	const Json::Value& right_obj(opr["right"]);
 
-	uint64_t left = expression_process(left_obj, script_context);
-	uint64_t right = expression_process(right_obj, script_context);
+static uint64_t apply_operator(uint16_t code, uint64_t left, uint64_t right)
+{
+	switch (code) {
+		case eop_and: return (left & right);
+		case eop_or: return (left | right);
+		case eop_not: return (~right);
+		case eop_shl: return (left << right);
+		case eop_shr: return (left >> right);
+		default: return 0;
+	}
+}
 
-	return (left | right);
+// Zeroed so that the padding written to the program cache is the same
+// every time
+static expression_op make_op(uint16_t code, uint32_t index, uint64_t value)
+{
+	expression_op op;
+	memset(&op, 0, sizeof(op));
+	op.code = code;
+	op.index = index;
+	op.value = value;
+	return op;
 }
 
-static uint64_t script_operator_not(const Json::Value& opr, script_context& script_context)
+static void compile_node(const Json::Value& value, std::vector<expression_op>& code, program& program, script_context& script_context)
 {
-	const Json::Value& value_obj(opr["right"]);
+	if (value.isString()) {
+		std::string str = value.asString();
+
+		if (str.length() == 0) {
+			code.push_back(make_op(eop_constant, 0, 0));
+
+		// Anything that starts with an alphabetic character is considered an identifier
+		} else if (isalpha(str[0])) {
+			code.push_back(make_op(eop_variable, script_context.find_variable(str), 0));
+
+		// Else parse as a number
+		} else {
+			code.push_back(make_op(eop_constant, 0, tu::parse_hex(str)));
+		}
+
+	} else if (value.isUInt64()) {
+		code.push_back(make_op(eop_constant, 0, value.asUInt64()));
 
-	uint64_t value = expression_process(value_obj, script_context);
+	} else if (value.isObject()) {
+		std::string opr = value["operator"].asString();
+		auto i = operator_map.find(opr);
+		if (i == operator_map.end()) {
+			throw script_exception(fmt() << "unknown operator: " << opr);
+		}
+
+		const operator_info& info((*i).second);
+		size_t first = code.size();
+
+		if (!info.unary) {
+			compile_node(value["left"], code, program, script_context);
+		}
 
-	return (~value);
+		size_t right = code.size();
+		compile_node(value["right"], code, program, script_context);
+
+		bool left_constant = info.unary || (right == first + 1 && code[first].code == eop_constant);
+		bool right_constant = (code.size() == right + 1 && code[right].code == eop_constant);
+
+		if (left_constant && right_constant) {
+			// Fold constant subtrees
+			uint64_t left_value = info.unary ? 0 : code[first].value;
+			uint64_t result = apply_operator(info.code, left_value, code[right].value);
+			code.resize(first);
+			code.push_back(make_op(eop_constant, 0, result));
+
+		} else if (right_constant && !info.unary) {
+			uint64_t right_value = code[right].value;
+			code.resize(right);
+			code.push_back(make_op(info.immediate_code, 0, right_value));
+
+		} else {
+			code.push_back(make_op(info.code, 0, 0));
+		}
+
+	} else {
+		throw script_exception("invalid value type");
+	}
 }
 
-static uint64_t script_operator_shl(const Json::Value& opr, script_context& script_context)
+void expression_validate(const program& program, const operand& operand, uint32_t variable_count)
 {
-	const Json::Value& left_obj(opr["left"]);
-	const Json::Value& right_obj(opr["right"]);
+	if (operand.kind == operand_constant) {
+		return;
+	}
+
+	if (operand.kind == operand_variable) {
+		if (operand.index >= variable_count) {
+			throw script_exception(fmt() << "invalid variable slot " << operand.index);
+		}
+		return;
+	}
 
-	uint64_t left = expression_process(left_obj, script_context);
-	uint64_t right = expression_process(right_obj, script_context);
+	if (operand.kind != operand_expression || operand.index > program.expression_code.size() ||
+		operand.value > program.expression_code.size() - operand.index) {
+		throw script_exception("invalid expression range");
+	}
+
+	// Run the code on the stack depth alone
+	size_t depth = 0;
+	for (uint64_t i=0; i < operand.value; ++i) {
+		const expression_op& op(program.expression_code[operand.index + i]);
+		size_t needed = 0;
+		size_t pushed = 0;
+
+		switch (op.code) {
+			case eop_variable:
+				if (op.index >= variable_count) {
+					throw script_exception(fmt() << "invalid variable slot " << op.index);
+				}
+				pushed = 1;
+				break;
+			case eop_constant: pushed = 1; break;
+			case eop_and:
+			case eop_or:
+			case eop_shl:
+			case eop_shr: needed = 2; pushed = 1; break;
+			case eop_not:
+			case eop_and_immediate:
+			case eop_or_immediate:
+			case eop_shl_immediate:
+			case eop_shr_immediate: needed = 1; pushed = 1; break;
+			default:
+				throw script_exception(fmt() << "invalid expression opcode " << op.code);
+		}
 
-	return (left << right);
+		if (depth < needed || depth - needed + pushed > max_stack_depth) {
+			throw script_exception("invalid expression stack use");
+		}
+		depth = depth - needed + pushed;
+	}
+
+	if (depth != 1) {
+		throw script_exception("invalid expression stack use");
+	}
 }
 
-static uint64_t script_operator_shr(const Json::Value& opr, script_context& script_context)
+static size_t stack_depth(const std::vector<expression_op>& code)
 {
-	const Json::Value& left_obj(opr["left"]);
-	const Json::Value& right_obj(opr["right"]);
+	size_t depth = 0;
+	size_t max_depth = 0;
 
-	uint64_t left = expression_process(left_obj, script_context);
-	uint64_t right = expression_process(right_obj, script_context);
+	for (const expression_op& op : code) {
+		switch (op.code) {
+			case eop_constant:
+			case eop_variable:
+				depth++;
+				break;
+			case eop_and:
+			case eop_or:
+			case eop_shl:
+			case eop_shr:
+				depth--;
+				break;
+		}
+
+		if (depth > max_depth) {
+			max_depth = depth;
+		}
+	}
 
-	return (left >> right);
+	return max_depth;
 }
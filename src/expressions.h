@@ -24,11 +24,29 @@
 #define EXPRESSION_H
 
 #include "script_context.h"
+#include "program.h"
 #include <jsoncpp/json/json.h>
 
 
 void expressions_init();
-uint64_t expression_process(const Json::Value& value, script_context& script_context);
+operand expression_compile(const Json::Value& value, program& program, script_context& script_context);
+uint64_t expression_run(const program& program, const operand& operand, const script_context& script_context);
+
+// Throws unless operand refers to well-formed code in program, reading
+// only variable slots below variable_count
+void expression_validate(const program& program, const operand& operand, uint32_t variable_count);
+
+
+inline uint64_t expression_evaluate(const program& program, const operand& operand, const script_context& script_context)
+{
+	if (operand.kind == operand_constant) {
+		return operand.value;
+	} else if (operand.kind == operand_variable) {
+		return script_context.get_variable(operand.index);
+	}
+
+	return expression_run(program, operand, script_context);
+}
 
 
 #endif
@@ -21,14 +21,148 @@
 */
 
 #include "logging.h"
+#include "output.h"
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
 
 
 int log::current_loglevel = ll_none;
 
 
+// Bounded multi-producer ring buffer for the asynchronous sink. Every slot
+// carries a sequence number: a producer may fill the slot when the number
+// equals its claimed position, and the drain thread may consume it once it
+// is one past that position. A line longer than one slot is split over
+// consecutive slots.
+struct log_slot
+{
+	std::atomic<uint64_t> sequence;
+	uint32_t length;
+	char text[244];
+};
+
+static const uint64_t ring_slots = 8192;
+
+// Lines that would need more slots than this are cut and marked
+static const uint64_t max_line_slots = 64;
+static const char truncated_mark[] = " [truncated]\n";
+
+static log_slot ring[ring_slots];
+static std::atomic<uint64_t> ring_head(0);
+static std::atomic<uint64_t> ring_tail(0);
+
+static std::atomic<bool> async_enabled(false);
+static std::atomic<bool> drain_running(false);
+
+// Threads between checking async_enabled and queueing their line.
+// Disabling the ring waits for them before stopping the drain thread.
+static std::atomic<int> producers(0);
+static std::thread drain_thread;
+
+
+static void write_line(const char* text, size_t length)
+{
+	fwrite(text, 1, length, stdout);
+}
+
+static void enqueue_line(const std::string& line)
+{
+	const uint64_t slot_size = sizeof(ring[0].text);
+	std::string text(line);
+
+	if (text.size() > max_line_slots * slot_size) {
+		text.resize(max_line_slots * slot_size - (sizeof(truncated_mark) - 1));
+		text += truncated_mark;
+	}
+
+	// All parts are claimed at once so that no other line comes between them
+	uint64_t parts = (text.size() + slot_size - 1) / slot_size;
+	uint64_t pos = ring_head.load(std::memory_order_relaxed);
+
+	for (;;) {
+		log_slot& slot(ring[pos & (ring_slots - 1)]);
+		uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+		int64_t difference = (int64_t)sequence - (int64_t)pos;
+
+		if (difference == 0) {
+			if (ring_head.compare_exchange_weak(pos, pos + parts, std::memory_order_relaxed)) {
+				break;
+			}
+		} else if (difference < 0) {
+			// Ring is full, wait for the drain thread to catch up
+			std::this_thread::yield();
+			pos = ring_head.load(std::memory_order_relaxed);
+		} else {
+			pos = ring_head.load(std::memory_order_relaxed);
+		}
+	}
+
+	for (uint64_t i=0; i < parts; ++i) {
+		log_slot& slot(ring[(pos + i) & (ring_slots - 1)]);
+
+		// Only the first slot was known to be free when claiming
+		while (slot.sequence.load(std::memory_order_acquire) != pos + i) {
+			std::this_thread::yield();
+		}
+
+		size_t offset = i * slot_size;
+		size_t length = std::min<size_t>(slot_size, text.size() - offset);
+		memcpy(slot.text, text.data() + offset, length);
+		slot.length = length;
+		slot.sequence.store(pos + i + 1, std::memory_order_release);
+	}
+}
+
+// Lets lines still in the ring be written before a direct write
+static void wait_for_drain()
+{
+	while (ring_tail.load(std::memory_order_acquire) != ring_head.load(std::memory_order_acquire)) {
+		std::this_thread::yield();
+	}
+}
+
+static void drain()
+{
+	for (;;) {
+		bool running = drain_running.load(std::memory_order_acquire);
+		uint64_t tail = ring_tail.load(std::memory_order_relaxed);
+		bool drained = false;
+
+		for (;;) {
+			log_slot& slot(ring[tail & (ring_slots - 1)]);
+			if (slot.sequence.load(std::memory_order_acquire) != tail + 1) {
+				break;
+			}
+
+			write_line(slot.text, slot.length);
+			slot.sequence.store(tail + ring_slots, std::memory_order_release);
+			ring_tail.store(++tail, std::memory_order_release);
+			drained = true;
+		}
+
+		if (drained) {
+			fflush(stdout);
+		} else if (!running) {
+			break;
+		} else {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+}
+
+static void stop_async()
+{
+	log::set_async(false);
+}
+
+
 log::log()
 {
 
@@ -45,7 +179,68 @@ log::~log()
 	_os << std::endl;
 
 	if (_loglevel <= current_loglevel) {
-		fprintf(stdout, "%s", _os.str().c_str());
-		fflush(stdout);
+		producers.fetch_add(1);
+		if (async_enabled.load()) {
+			enqueue_line(_os.str());
+			producers.fetch_sub(1);
+		} else {
+			producers.fetch_sub(1);
+
+			// Keep log lines in order with buffered script output, and
+			// with lines queued before the ring was disabled
+			wait_for_drain();
+			output_flush();
+			std::string line = _os.str();
+			write_line(line.data(), line.size());
+			fflush(stdout);
+		}
+	}
+}
+
+void log::set_async(bool async)
+{
+	static bool registered = false;
+
+	if (async == async_enabled.load()) {
+		return;
+	}
+
+	if (async) {
+		// Positions continue from where the ring was last disabled
+		uint64_t head = ring_head.load();
+		for (uint64_t i=0; i < ring_slots; ++i) {
+			ring[(head + i) & (ring_slots - 1)].sequence.store(head + i);
+		}
+
+		if (!registered) {
+			atexit(stop_async);
+			registered = true;
+		}
+
+		output_flush();
+		drain_running = true;
+		drain_thread = std::thread(drain);
+		async_enabled = true;
+
+	} else {
+		// Threads that saw the ring enabled finish queueing before the
+		// drain thread is told to stop; it then writes everything queued
+		async_enabled = false;
+		while (producers.load() != 0) {
+			std::this_thread::yield();
+		}
+		drain_running = false;
+		drain_thread.join();
+	}
+}
+
+void log::flush()
+{
+	if (!async_enabled.load()) {
+		return;
+	}
+
+	while (ring_tail.load(std::memory_order_acquire) != ring_head.load(std::memory_order_acquire)) {
+		std::this_thread::yield();
 	}
 }
@@ -43,6 +43,13 @@ public:
 	virtual ~log();
 	std::ostringstream& get(int loglevel);
 
+	// Switches between writing log lines directly and handing them to a
+	// background thread through a lock-free ring buffer
+	static void set_async(bool async);
+
+	// Waits until all queued log lines have been written
+	static void flush();
+
 public:
 	static int current_loglevel;
 
@@ -58,7 +65,10 @@ private:
 };
 
 
-#define LOG(loglevel) log().get(loglevel)
+// The level is checked before the log object is built, so disabled log
+// statements do not format any of their arguments
+#define LOG(loglevel) \
+	if ((loglevel) > log::current_loglevel) {} else log().get(loglevel)
 
 
 #endif
@@ -21,40 +21,135 @@
 */
 
 #include "commands.h"
+#include "daemon.h"
+#include "profile.h"
+#include "program_cache.h"
+#include "script_exception.h"
+#include "stream.h"
+#include "trace.h"
 #include "expressions.h"
+#include "memory_ops.h"
+#include "checksum.h"
+#include "output.h"
+#include "logging.h"
 
 #include <jsoncpp/json/json.h>
 
 #include <fstream>
 #include <iostream>
+#include <string>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
 
 
 int main(int argc, char **argv)
 {
+	// Kept outside the try block so failed runs are reported as well
+	std::string profile_file;
+	std::string profile_script;
+
 	try {
 
+		output_init();
+		memory_ops_init();
+		checksum_init();
 		expressions_init();
 		commands_init();
 
-		Json::Value root;
+		// agamemnon [--cache | --stream] [--profile[=<file>]] [--trace <file>] [--daemon <socket>] [script]
+		// agamemnon --print-trace <file>
+		bool use_cache = false;
+		bool stream = false;
+		const char* daemon_socket = nullptr;
+		const char* trace_file = nullptr;
+		const char* script_file = nullptr;
+
+		for (int i=1; i < argc; ++i) {
+			std::string arg(argv[i]);
+			if (arg == "--cache") {
+				use_cache = true;
+			} else if (arg == "--stream") {
+				stream = true;
+			} else if (arg == "--profile") {
+				profile_enabled = true;
+			} else if (arg.compare(0, 10, "--profile=") == 0) {
+				profile_enabled = true;
+				profile_file = arg.substr(10);
+			} else if (arg == "--trace" && i + 1 < argc) {
+				trace_file = argv[++i];
+			} else if (arg == "--print-trace" && i + 1 < argc) {
+				trace_print(argv[++i]);
+				return 0;
+			} else if (arg == "--daemon" && i + 1 < argc) {
+				daemon_socket = argv[++i];
+			} else {
+				script_file = argv[i];
+			}
+		}
+
+		if (script_file) {
+			profile_script = script_file;
+		}
 
-		if (argc > 1) {
-			std::ifstream file(argv[1]);
-			file >> root;
-		} else {
-			std::cin >> root;
+		if (trace_file) {
+			trace_open(trace_file);
 		}
 
 		script_context context;
-		command_process(root, context);
+
+		if (stream) {
+			int fd = script_file ? open(script_file, O_RDONLY) : STDIN_FILENO;
+			if (fd == -1) {
+				throw script_exception(fmt() << "could not open " << script_file << ": " << strerror(errno));
+			}
+			stream_process(fd, context);
+
+		} else if (script_file && use_cache) {
+			program program;
+			program_load_cached(script_file, program, context);
+			program_execute(program, context);
+
+		} else if (script_file || !daemon_socket) {
+			Json::Value root;
+
+			if (script_file) {
+				std::ifstream file(script_file);
+				file >> root;
+			} else {
+				std::cin >> root;
+			}
+
+			command_process(root, context);
+		}
+
+		if (daemon_socket) {
+			daemon_run(daemon_socket, context);
+		}
+
+		trace_close();
+
+		if (profile_enabled) {
+			output_flush();
+			profile_report(profile_file, profile_script);
+		}
 
 		return 0;
 
 	} catch (std::exception& e) {
 
+		log::flush();
+		output_flush();
+		trace_close();
+
 		std::fprintf(stderr, "script error:\n");
 		std::fprintf(stderr, "%s\n", e.what());
 
+		if (profile_enabled) {
+			profile_report(profile_file, profile_script);
+		}
+
 		return 1;
 	}
 }
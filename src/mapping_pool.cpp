@@ -0,0 +1,180 @@
+/*
+	Copyright (c) 2017 Willem Kemp
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#include "mapping_pool.h"
+#include "logging.h"
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
+
+
+static const uint64_t huge_page_size = 2 * 1024 * 1024;
+
+
+mapping_pool::mapping_pool() :
+	_page_size(sysconf(_SC_PAGE_SIZE)),
+	_fd(-1)
+{
+
+}
+
+mapping_pool::~mapping_pool()
+{
+	for (mapping& mapping : _mappings) {
+		if (mapping.base != nullptr) {
+			unmap_range(mapping);
+		}
+	}
+
+	if (_fd != -1) {
+		close(_fd);
+	}
+}
+
+void mapping_pool::reserve(uint64_t address, uint64_t size, const mapping_options& options)
+{
+	uint64_t page_mask = (_page_size - 1);
+	uint64_t start = address & ~page_mask;
+	uint64_t end = (address + size + page_mask) & ~page_mask;
+	mapping_options merged_options = options;
+
+	// Nothing to do if an existing mapping already covers the range
+	for (const mapping& mapping : _mappings) {
+		if (mapping.base != nullptr && mapping.address <= start && end <= mapping.address + mapping.size) {
+			return;
+		}
+	}
+
+	// Absorb every pending range that overlaps or touches this one.
+	// Ranges that are already mapped cannot grow and are left alone.
+	bool merged = true;
+	while (merged) {
+		merged = false;
+		for (auto i = _mappings.begin(); i != _mappings.end(); ++i) {
+			if ((*i).base == nullptr && (*i).address <= end && start <= (*i).address + (*i).size) {
+				start = std::min(start, (*i).address);
+				end = std::max(end, (*i).address + (*i).size);
+				merged_options.prefault |= (*i).options.prefault;
+				merged_options.hugepages |= (*i).options.hugepages;
+				if (merged_options.advice != (*i).options.advice) {
+					merged_options.advice = advice_normal;
+				}
+				_mappings.erase(i);
+				merged = true;
+				break;
+			}
+		}
+	}
+
+	_mappings.push_back({ start, end - start, nullptr, merged_options });
+}
+
+void* mapping_pool::map(uint64_t address, uint64_t size, const mapping_options& options)
+{
+	uint64_t page_mask = (_page_size - 1);
+	uint64_t start = address & ~page_mask;
+	uint64_t end = (address + size + page_mask) & ~page_mask;
+
+	mapping* mapping = find(start, end);
+
+	// Regions that were not reserved up front get a range of their own
+	if (mapping == nullptr) {
+		reserve(address, size, options);
+		mapping = find(start, end);
+	}
+
+	if (mapping->base == nullptr) {
+		map_range(*mapping);
+		apply_advice(*mapping);
+		LOG(ll_vv) << "mapping_pool: mapped address=" << std::hex << mapping->address << ", size=" << mapping->size
+			<< ", prefault=" << mapping->options.prefault << ", hugepages=" << mapping->options.hugepages;
+	}
+
+	return (uint8_t*)mapping->base + (address - mapping->address);
+}
+
+mapping_pool::mapping* mapping_pool::find(uint64_t start, uint64_t end)
+{
+	mapping* pending = nullptr;
+
+	for (mapping& mapping : _mappings) {
+		if (mapping.address <= start && end <= mapping.address + mapping.size) {
+			if (mapping.base != nullptr) {
+				return &mapping;
+			}
+			pending = &mapping;
+		}
+	}
+
+	return pending;
+}
+
+// Reserves inaccessible address space for a mapping. With huge pages
+// requested, the virtual address is chosen to be congruent to the physical
+// address modulo the huge page size, so every naturally aligned huge page
+// inside the physical range can be mapped with a single entry. The backend
+// maps over the reservation with MAP_FIXED.
+void* mapping_pool::reserve_address_space(const mapping& mapping)
+{
+	uint64_t alignment = mapping.options.hugepages ? huge_page_size : _page_size;
+	uint64_t padded_size = mapping.size + alignment;
+
+	uint8_t* base = (uint8_t*)mmap(0, padded_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (base == (void *) -1) {
+		return nullptr;
+	}
+
+	uint64_t misalignment = ((uint64_t)base - mapping.address) & (alignment - 1);
+	uint8_t* aligned = base + ((alignment - misalignment) & (alignment - 1));
+
+	// Release the padding on either side
+	if (aligned > base) {
+		munmap(base, aligned - base);
+	}
+	munmap(aligned + mapping.size, (base + padded_size) - (aligned + mapping.size));
+
+	return aligned;
+}
+
+void mapping_pool::apply_advice(const mapping& mapping)
+{
+	int advice = MADV_NORMAL;
+
+	switch (mapping.options.advice) {
+		case advice_normal: advice = MADV_NORMAL; break;
+		case advice_sequential: advice = MADV_SEQUENTIAL; break;
+		case advice_random: advice = MADV_RANDOM; break;
+		case advice_willneed: advice = MADV_WILLNEED; break;
+	}
+
+	// Hints are best effort; device mappings reject some of them
+	if (advice != MADV_NORMAL && madvise(mapping.base, mapping.size, advice) != 0) {
+		LOG(ll_vv) << "mapping_pool: madvise not supported for address=" << std::hex << mapping.address;
+	}
+
+#ifdef MADV_HUGEPAGE
+	if (mapping.options.hugepages && madvise(mapping.base, mapping.size, MADV_HUGEPAGE) != 0) {
+		LOG(ll_vv) << "mapping_pool: transparent huge pages not supported for address=" << std::hex << mapping.address;
+	}
+#endif
+}
@@ -0,0 +1,94 @@
+/*
+	Copyright (c) 2017 Willem Kemp
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#ifndef MAPPING_POOL_H
+#define MAPPING_POOL_H
+
+#include <cstdint>
+#include <vector>
+
+
+enum mapping_advice : uint32_t
+{
+	advice_normal,
+	advice_sequential,
+	advice_random,
+	advice_willneed
+};
+
+struct mapping_options
+{
+	// Populate the page tables when mapping instead of on first access
+	bool prefault;
+
+	// Align the mapping so that huge pages can back it where the
+	// physical range allows
+	bool hugepages;
+
+	// Access pattern hint passed to madvise
+	mapping_advice advice;
+};
+
+
+// Maps physical memory on behalf of all regions of a script context.
+// Regions are reserved while the script is compiled, so overlapping and
+// adjacent ranges can be merged into a single mapping before anything is
+// mapped. Each region then gets a view into the mapping that covers it.
+// All mappings share one file descriptor and live as long as the pool.
+class mapping_pool
+{
+public:
+	mapping_pool();
+	~mapping_pool();
+
+	void reserve(uint64_t address, uint64_t size, const mapping_options& options);
+	void* map(uint64_t address, uint64_t size, const mapping_options& options);
+
+private:
+	struct mapping
+	{
+		uint64_t address;
+		uint64_t size;
+		void* base;
+		mapping_options options;
+	};
+
+	mapping* find(uint64_t start, uint64_t end);
+	void* reserve_address_space(const mapping& mapping);
+	void apply_advice(const mapping& mapping);
+
+	// Implemented by the backend
+	void map_range(mapping& mapping);
+	void unmap_range(mapping& mapping);
+
+private:
+	mapping_pool(const mapping_pool&) = delete;
+	mapping_pool& operator =(const mapping_pool&) = delete;
+
+private:
+	std::vector<mapping> _mappings;
+	uint64_t _page_size;
+	int _fd;
+};
+
+
+#endif
@@ -0,0 +1,59 @@
+/*
+	Copyright (c) 2017 Willem Kemp
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#include "mapping_pool.h"
+#include "script_exception.h"
+
+#include <sys/mman.h>
+
+
+// Backs every mapping with anonymous memory, honouring the same mapping
+// options as the /dev/mem backend so their effect can be measured.
+void mapping_pool::map_range(mapping& mapping)
+{
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	void* address = reserve_address_space(mapping);
+
+	if (address != nullptr) {
+		flags |= MAP_FIXED;
+	}
+
+	if (mapping.options.prefault) {
+		flags |= MAP_POPULATE;
+	}
+
+	void* base = mmap(address, mapping.size, PROT_READ | PROT_WRITE, flags, -1, 0);
+	if (base == (void *) -1) {
+		if (address != nullptr) {
+			munmap(address, mapping.size);
+		}
+		throw script_exception(fmt() << "Could not map memory at " << std::hex << mapping.address);
+	}
+
+	mapping.base = base;
+}
+
+void mapping_pool::unmap_range(mapping& mapping)
+{
+	munmap(mapping.base, mapping.size);
+	mapping.base = nullptr;
+}
@@ -0,0 +1,589 @@
+/*
+	Copyright (c) 2017 Willem Kemp
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#include "memory_ops.h"
+
+#include <cstddef>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MEMORY_OPS_X86
+#endif
+
+
+typedef void (*fill_kernel_t)(void* ptr, uint64_t count, uint64_t value, uint64_t increment, bool non_temporal);
+typedef uint64_t (*find_mismatch_kernel_t)(const void* ptr, uint64_t count, uint64_t value, uint64_t increment, uint64_t mask);
+typedef void (*copy_kernel_t)(void* dst, const void* src, uint64_t size);
+typedef uint64_t (*find_difference_kernel_t)(const void* ptr, const void* expected, uint64_t size);
+
+// Indexed by log2(width / 8)
+static fill_kernel_t fill_kernels[4];
+static find_mismatch_kernel_t find_mismatch_kernels[4];
+static copy_kernel_t copy_non_temporal_kernel;
+static find_difference_kernel_t find_difference_kernel;
+static const char* isa_name = "scalar";
+
+
+static int width_index(uint32_t width)
+{
+	switch (width) {
+		case 8: return 0;
+		case 16: return 1;
+		case 32: return 2;
+		default: return 3;
+	}
+}
+
+
+template <typename T>
+static void fill_exact(void* ptr, uint64_t count, uint64_t value, uint64_t increment)
+{
+	volatile T* p = (volatile T*)ptr;
+	for (uint64_t i=0; i < count; ++i) {
+		*p++ = value;
+		value += increment;
+	}
+}
+
+template <typename T>
+static void fill_scalar(void* ptr, uint64_t count, uint64_t value, uint64_t increment, bool)
+{
+	T* p = (T*)ptr;
+	for (uint64_t i=0; i < count; ++i) {
+		*p++ = value;
+		value += increment;
+	}
+}
+
+template <typename T>
+static uint64_t find_mismatch_exact(const void* ptr, uint64_t count, uint64_t value, uint64_t increment, uint64_t mask)
+{
+	const volatile T* p = (const volatile T*)ptr;
+	for (uint64_t i=0; i < count; ++i) {
+		if (((p[i] ^ (T)value) & (T)mask) != 0) {
+			return i;
+		}
+		value += increment;
+	}
+	return count;
+}
+
+template <typename T>
+static uint64_t find_mismatch_scalar(const void* ptr, uint64_t count, uint64_t value, uint64_t increment, uint64_t mask)
+{
+	const T* p = (const T*)ptr;
+	for (uint64_t i=0; i < count; ++i) {
+		if (((p[i] ^ (T)value) & (T)mask) != 0) {
+			return i;
+		}
+		value += increment;
+	}
+	return count;
+}
+
+template <typename T>
+static void copy_exact(void* dst, const void* src, uint64_t count)
+{
+	volatile T* d = (volatile T*)dst;
+	const volatile T* s = (const volatile T*)src;
+	for (uint64_t i=0; i < count; ++i) {
+		d[i] = s[i];
+	}
+}
+
+// Copies from the last element down, for overlapping ranges where the
+// destination lies above the source.
+template <typename T>
+static void copy_exact_backward(void* dst, const void* src, uint64_t count)
+{
+	volatile T* d = (volatile T*)dst;
+	const volatile T* s = (const volatile T*)src;
+	while (count-- > 0) {
+		d[count] = s[count];
+	}
+}
+
+static void copy_scalar(void* dst, const void* src, uint64_t size)
+{
+	memcpy(dst, src, size);
+}
+
+template <typename T>
+static uint64_t find_difference_exact(const void* ptr, const void* expected, uint64_t count)
+{
+	const volatile T* p = (const volatile T*)ptr;
+	const T* e = (const T*)expected;
+	for (uint64_t i=0; i < count; ++i) {
+		if (p[i] != e[i]) {
+			return i;
+		}
+	}
+	return count;
+}
+
+// The find_difference kernels work on bytes and return the offset of the
+// first differing byte, or size.
+static uint64_t find_difference_scalar(const void* ptr, const void* expected, uint64_t size)
+{
+	const uint8_t* p = (const uint8_t*)ptr;
+	const uint8_t* e = (const uint8_t*)expected;
+	for (uint64_t i=0; i < size; ++i) {
+		if (p[i] != e[i]) {
+			return i;
+		}
+	}
+	return size;
+}
+
+
+#ifdef MEMORY_OPS_X86
+
+// Both vector kernels store whole vectors of consecutive elements. The first
+// vector holds value, value + increment, ...; every following vector adds
+// lanes * increment to each lane. Lane arithmetic wraps at the element width
+// exactly like the scalar loop does.
+
+static inline __m128i add_lanes_sse2(__m128i a, __m128i b, uint8_t) { return _mm_add_epi8(a, b); }
+static inline __m128i add_lanes_sse2(__m128i a, __m128i b, uint16_t) { return _mm_add_epi16(a, b); }
+static inline __m128i add_lanes_sse2(__m128i a, __m128i b, uint32_t) { return _mm_add_epi32(a, b); }
+static inline __m128i add_lanes_sse2(__m128i a, __m128i b, uint64_t) { return _mm_add_epi64(a, b); }
+
+template <typename T>
+static void fill_sse2(void* ptr, uint64_t count, uint64_t value, uint64_t increment, bool non_temporal)
+{
+	const uint64_t lanes = sizeof(__m128i) / sizeof(T);
+	T* p = (T*)ptr;
+
+	// Scalar head up to vector alignment
+	while (count > 0 && ((uintptr_t)p & (sizeof(__m128i) - 1)) != 0) {
+		*p++ = value;
+		value += increment;
+		--count;
+	}
+
+	alignas(16) T initial[lanes];
+	alignas(16) T step[lanes];
+	for (uint64_t l=0; l < lanes; ++l) {
+		initial[l] = value + l * increment;
+		step[l] = lanes * increment;
+	}
+
+	__m128i v = _mm_load_si128((const __m128i*)initial);
+	__m128i s = _mm_load_si128((const __m128i*)step);
+	uint64_t blocks = count / lanes;
+
+	if (non_temporal) {
+		for (uint64_t i=0; i < blocks; ++i) {
+			_mm_stream_si128((__m128i*)p, v);
+			v = add_lanes_sse2(v, s, T());
+			p += lanes;
+		}
+		_mm_sfence();
+	} else {
+		for (uint64_t i=0; i < blocks; ++i) {
+			_mm_store_si128((__m128i*)p, v);
+			v = add_lanes_sse2(v, s, T());
+			p += lanes;
+		}
+	}
+
+	value += blocks * lanes * increment;
+	count -= blocks * lanes;
+
+	for (uint64_t i=0; i < count; ++i) {
+		*p++ = value;
+		value += increment;
+	}
+}
+
+// The compare kernels XOR each vector with the expected sequence, apply the
+// mask and look for the first non-zero byte, which works for every width.
+template <typename T>
+static uint64_t find_mismatch_sse2(const void* ptr, uint64_t count, uint64_t value, uint64_t increment, uint64_t mask)
+{
+	const uint64_t lanes = sizeof(__m128i) / sizeof(T);
+	const __m128i* p = (const __m128i*)ptr;
+
+	alignas(16) T initial[lanes];
+	alignas(16) T step[lanes];
+	alignas(16) T masks[lanes];
+	for (uint64_t l=0; l < lanes; ++l) {
+		initial[l] = value + l * increment;
+		step[l] = lanes * increment;
+		masks[l] = mask;
+	}
+
+	__m128i v = _mm_load_si128((const __m128i*)initial);
+	__m128i s = _mm_load_si128((const __m128i*)step);
+	__m128i m = _mm_load_si128((const __m128i*)masks);
+	__m128i zero = _mm_setzero_si128();
+	uint64_t blocks = count / lanes;
+
+	for (uint64_t i=0; i < blocks; ++i) {
+		__m128i diff = _mm_and_si128(_mm_xor_si128(_mm_loadu_si128(p + i), v), m);
+		uint32_t equal = _mm_movemask_epi8(_mm_cmpeq_epi8(diff, zero));
+		if (equal != 0xffff) {
+			return i * lanes + __builtin_ctz(~equal) / sizeof(T);
+		}
+		v = add_lanes_sse2(v, s, T());
+	}
+
+	uint64_t done = blocks * lanes;
+	return done + find_mismatch_scalar<T>((const T*)ptr + done, count - done, value + done * increment, increment, mask);
+}
+
+// The non-temporal copy kernels align the destination, then stream whole
+// vectors loaded from a possibly unaligned source.
+static void copy_non_temporal_sse2(void* dst, const void* src, uint64_t size)
+{
+	uint8_t* d = (uint8_t*)dst;
+	const uint8_t* s = (const uint8_t*)src;
+
+	uint64_t head = (-(uintptr_t)d) & (sizeof(__m128i) - 1);
+	if (head > size) {
+		head = size;
+	}
+	memcpy(d, s, head);
+	d += head;
+	s += head;
+	size -= head;
+
+	uint64_t blocks = size / sizeof(__m128i);
+	for (uint64_t i=0; i < blocks; ++i) {
+		_mm_stream_si128((__m128i*)d, _mm_loadu_si128((const __m128i*)s));
+		d += sizeof(__m128i);
+		s += sizeof(__m128i);
+	}
+	_mm_sfence();
+
+	memcpy(d, s, size - blocks * sizeof(__m128i));
+}
+
+static uint64_t find_difference_sse2(const void* ptr, const void* expected, uint64_t size)
+{
+	const __m128i* p = (const __m128i*)ptr;
+	const __m128i* e = (const __m128i*)expected;
+	uint64_t blocks = size / sizeof(__m128i);
+
+	for (uint64_t i=0; i < blocks; ++i) {
+		uint32_t equal = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(p + i), _mm_loadu_si128(e + i)));
+		if (equal != 0xffff) {
+			return i * sizeof(__m128i) + __builtin_ctz(~equal);
+		}
+	}
+
+	uint64_t done = blocks * sizeof(__m128i);
+	return done + find_difference_scalar((const uint8_t*)ptr + done, (const uint8_t*)expected + done, size - done);
+}
+
+__attribute__((target("avx2"))) static inline __m256i add_lanes_avx2(__m256i a, __m256i b, uint8_t) { return _mm256_add_epi8(a, b); }
+__attribute__((target("avx2"))) static inline __m256i add_lanes_avx2(__m256i a, __m256i b, uint16_t) { return _mm256_add_epi16(a, b); }
+__attribute__((target("avx2"))) static inline __m256i add_lanes_avx2(__m256i a, __m256i b, uint32_t) { return _mm256_add_epi32(a, b); }
+__attribute__((target("avx2"))) static inline __m256i add_lanes_avx2(__m256i a, __m256i b, uint64_t) { return _mm256_add_epi64(a, b); }
+
+template <typename T>
+__attribute__((target("avx2")))
+static void fill_avx2(void* ptr, uint64_t count, uint64_t value, uint64_t increment, bool non_temporal)
+{
+	const uint64_t lanes = sizeof(__m256i) / sizeof(T);
+	T* p = (T*)ptr;
+
+	// Scalar head up to vector alignment
+	while (count > 0 && ((uintptr_t)p & (sizeof(__m256i) - 1)) != 0) {
+		*p++ = value;
+		value += increment;
+		--count;
+	}
+
+	alignas(32) T initial[lanes];
+	alignas(32) T step[lanes];
+	for (uint64_t l=0; l < lanes; ++l) {
+		initial[l] = value + l * increment;
+		step[l] = lanes * increment;
+	}
+
+	__m256i v = _mm256_load_si256((const __m256i*)initial);
+	__m256i s = _mm256_load_si256((const __m256i*)step);
+	uint64_t blocks = count / lanes;
+
+	if (non_temporal) {
+		for (uint64_t i=0; i < blocks; ++i) {
+			_mm256_stream_si256((__m256i*)p, v);
+			v = add_lanes_avx2(v, s, T());
+			p += lanes;
+		}
+		_mm_sfence();
+	} else {
+		for (uint64_t i=0; i < blocks; ++i) {
+			_mm256_store_si256((__m256i*)p, v);
+			v = add_lanes_avx2(v, s, T());
+			p += lanes;
+		}
+	}
+
+	value += blocks * lanes * increment;
+	count -= blocks * lanes;
+
+	for (uint64_t i=0; i < count; ++i) {
+		*p++ = value;
+		value += increment;
+	}
+}
+
+template <typename T>
+__attribute__((target("avx2")))
+static uint64_t find_mismatch_avx2(const void* ptr, uint64_t count, uint64_t value, uint64_t increment, uint64_t mask)
+{
+	const uint64_t lanes = sizeof(__m256i) / sizeof(T);
+	const __m256i* p = (const __m256i*)ptr;
+
+	alignas(32) T initial[lanes];
+	alignas(32) T step[lanes];
+	alignas(32) T masks[lanes];
+	for (uint64_t l=0; l < lanes; ++l) {
+		initial[l] = value + l * increment;
+		step[l] = lanes * increment;
+		masks[l] = mask;
+	}
+
+	__m256i v = _mm256_load_si256((const __m256i*)initial);
+	__m256i s = _mm256_load_si256((const __m256i*)step);
+	__m256i m = _mm256_load_si256((const __m256i*)masks);
+	__m256i zero = _mm256_setzero_si256();
+	uint64_t blocks = count / lanes;
+
+	for (uint64_t i=0; i < blocks; ++i) {
+		__m256i diff = _mm256_and_si256(_mm256_xor_si256(_mm256_loadu_si256(p + i), v), m);
+		uint32_t equal = _mm256_movemask_epi8(_mm256_cmpeq_epi8(diff, zero));
+		if (equal != 0xffffffff) {
+			return i * lanes + __builtin_ctz(~equal) / sizeof(T);
+		}
+		v = add_lanes_avx2(v, s, T());
+	}
+
+	uint64_t done = blocks * lanes;
+	return done + find_mismatch_scalar<T>((const T*)ptr + done, count - done, value + done * increment, increment, mask);
+}
+
+__attribute__((target("avx2")))
+static void copy_non_temporal_avx2(void* dst, const void* src, uint64_t size)
+{
+	uint8_t* d = (uint8_t*)dst;
+	const uint8_t* s = (const uint8_t*)src;
+
+	uint64_t head = (-(uintptr_t)d) & (sizeof(__m256i) - 1);
+	if (head > size) {
+		head = size;
+	}
+	memcpy(d, s, head);
+	d += head;
+	s += head;
+	size -= head;
+
+	uint64_t blocks = size / sizeof(__m256i);
+	for (uint64_t i=0; i < blocks; ++i) {
+		_mm256_stream_si256((__m256i*)d, _mm256_loadu_si256((const __m256i*)s));
+		d += sizeof(__m256i);
+		s += sizeof(__m256i);
+	}
+	_mm_sfence();
+
+	memcpy(d, s, size - blocks * sizeof(__m256i));
+}
+
+__attribute__((target("avx2")))
+static uint64_t find_difference_avx2(const void* ptr, const void* expected, uint64_t size)
+{
+	const __m256i* p = (const __m256i*)ptr;
+	const __m256i* e = (const __m256i*)expected;
+	uint64_t blocks = size / sizeof(__m256i);
+
+	for (uint64_t i=0; i < blocks; ++i) {
+		uint32_t equal = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(p + i), _mm256_loadu_si256(e + i)));
+		if (equal != 0xffffffff) {
+			return i * sizeof(__m256i) + __builtin_ctz(~equal);
+		}
+	}
+
+	uint64_t done = blocks * sizeof(__m256i);
+	return done + find_difference_scalar((const uint8_t*)ptr + done, (const uint8_t*)expected + done, size - done);
+}
+
+#endif
+
+
+void memory_ops_init()
+{
+	fill_kernels[0] = fill_scalar<uint8_t>;
+	fill_kernels[1] = fill_scalar<uint16_t>;
+	fill_kernels[2] = fill_scalar<uint32_t>;
+	fill_kernels[3] = fill_scalar<uint64_t>;
+
+	find_mismatch_kernels[0] = find_mismatch_scalar<uint8_t>;
+	find_mismatch_kernels[1] = find_mismatch_scalar<uint16_t>;
+	find_mismatch_kernels[2] = find_mismatch_scalar<uint32_t>;
+	find_mismatch_kernels[3] = find_mismatch_scalar<uint64_t>;
+
+	copy_non_temporal_kernel = copy_scalar;
+	find_difference_kernel = find_difference_scalar;
+
+#ifdef MEMORY_OPS_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2")) {
+		isa_name = "avx2";
+		fill_kernels[0] = fill_avx2<uint8_t>;
+		fill_kernels[1] = fill_avx2<uint16_t>;
+		fill_kernels[2] = fill_avx2<uint32_t>;
+		fill_kernels[3] = fill_avx2<uint64_t>;
+		find_mismatch_kernels[0] = find_mismatch_avx2<uint8_t>;
+		find_mismatch_kernels[1] = find_mismatch_avx2<uint16_t>;
+		find_mismatch_kernels[2] = find_mismatch_avx2<uint32_t>;
+		find_mismatch_kernels[3] = find_mismatch_avx2<uint64_t>;
+		copy_non_temporal_kernel = copy_non_temporal_avx2;
+		find_difference_kernel = find_difference_avx2;
+
+	} else if (__builtin_cpu_supports("sse2")) {
+		isa_name = "sse2";
+		fill_kernels[0] = fill_sse2<uint8_t>;
+		fill_kernels[1] = fill_sse2<uint16_t>;
+		fill_kernels[2] = fill_sse2<uint32_t>;
+		fill_kernels[3] = fill_sse2<uint64_t>;
+		find_mismatch_kernels[0] = find_mismatch_sse2<uint8_t>;
+		find_mismatch_kernels[1] = find_mismatch_sse2<uint16_t>;
+		find_mismatch_kernels[2] = find_mismatch_sse2<uint32_t>;
+		find_mismatch_kernels[3] = find_mismatch_sse2<uint64_t>;
+		copy_non_temporal_kernel = copy_non_temporal_sse2;
+		find_difference_kernel = find_difference_sse2;
+	}
+#endif
+}
+
+const char* memory_ops_isa()
+{
+	return isa_name;
+}
+
+void memory_fill(void* ptr, uint32_t width, uint64_t count, uint64_t value, uint64_t increment, access_mode mode)
+{
+	if (mode == access_exact) {
+		switch (width) {
+			case 8: fill_exact<uint8_t>(ptr, count, value, increment); break;
+			case 16: fill_exact<uint16_t>(ptr, count, value, increment); break;
+			case 32: fill_exact<uint32_t>(ptr, count, value, increment); break;
+			case 64: fill_exact<uint64_t>(ptr, count, value, increment); break;
+		}
+		return;
+	}
+
+	fill_kernels[width_index(width)](ptr, count, value, increment, mode == access_non_temporal);
+}
+
+uint64_t memory_find_mismatch(const void* ptr, uint32_t width, uint64_t count, uint64_t value, uint64_t increment, uint64_t mask, access_mode mode)
+{
+	if (mode == access_exact) {
+		switch (width) {
+			case 8: return find_mismatch_exact<uint8_t>(ptr, count, value, increment, mask);
+			case 16: return find_mismatch_exact<uint16_t>(ptr, count, value, increment, mask);
+			case 32: return find_mismatch_exact<uint32_t>(ptr, count, value, increment, mask);
+			default: return find_mismatch_exact<uint64_t>(ptr, count, value, increment, mask);
+		}
+	}
+
+	return find_mismatch_kernels[width_index(width)](ptr, count, value, increment, mask);
+}
+
+void memory_copy(void* dst, const void* src, uint32_t width, uint64_t count, access_mode mode)
+{
+	switch (mode) {
+		case access_exact:
+			switch (width) {
+				case 8: copy_exact<uint8_t>(dst, src, count); break;
+				case 16: copy_exact<uint16_t>(dst, src, count); break;
+				case 32: copy_exact<uint32_t>(dst, src, count); break;
+				case 64: copy_exact<uint64_t>(dst, src, count); break;
+			}
+			break;
+		case access_non_temporal:
+			copy_non_temporal_kernel(dst, src, count * (width / 8));
+			break;
+		default:
+			memcpy(dst, src, count * (width / 8));
+			break;
+	}
+}
+
+void memory_move(void* dst, const void* src, uint32_t width, uint64_t count, access_mode mode)
+{
+	uint64_t size = count * (width / 8);
+	uintptr_t d = (uintptr_t)dst;
+	uintptr_t s = (uintptr_t)src;
+
+	if (d >= s + size || s >= d + size) {
+		memory_copy(dst, src, width, count, mode);
+		return;
+	}
+
+	if (mode != access_exact) {
+		// Streaming stores gain nothing when the source was just cached
+		memmove(dst, src, size);
+	} else if (d <= s) {
+		memory_copy(dst, src, width, count, mode);
+	} else {
+		switch (width) {
+			case 8: copy_exact_backward<uint8_t>(dst, src, count); break;
+			case 16: copy_exact_backward<uint16_t>(dst, src, count); break;
+			case 32: copy_exact_backward<uint32_t>(dst, src, count); break;
+			case 64: copy_exact_backward<uint64_t>(dst, src, count); break;
+		}
+	}
+}
+
+void memory_move_aliased(void* dst, const void* src, uint32_t width, uint64_t count, bool backward)
+{
+	if (!backward) {
+		memory_copy(dst, src, width, count, access_exact);
+		return;
+	}
+
+	switch (width) {
+		case 8: copy_exact_backward<uint8_t>(dst, src, count); break;
+		case 16: copy_exact_backward<uint16_t>(dst, src, count); break;
+		case 32: copy_exact_backward<uint32_t>(dst, src, count); break;
+		case 64: copy_exact_backward<uint64_t>(dst, src, count); break;
+	}
+}
+
+uint64_t memory_find_difference(const void* ptr, const void* expected, uint32_t width, uint64_t count, access_mode mode)
+{
+	if (mode == access_exact) {
+		switch (width) {
+			case 8: return find_difference_exact<uint8_t>(ptr, expected, count);
+			case 16: return find_difference_exact<uint16_t>(ptr, expected, count);
+			case 32: return find_difference_exact<uint32_t>(ptr, expected, count);
+			default: return find_difference_exact<uint64_t>(ptr, expected, count);
+		}
+	}
+
+	return find_difference_kernel(ptr, expected, count * (width / 8)) / (width / 8);
+}
@@ -0,0 +1,87 @@
+/*
+	Copyright (c) 2017 Willem Kemp
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#ifndef MEMORY_OPS_H
+#define MEMORY_OPS_H
+
+#include <cstdint>
+
+
+// How bulk operations access a memory region
+enum access_mode : uint32_t
+{
+	// Use the widest loads and stores the CPU supports
+	access_vector,
+
+	// As access_vector, but stores bypass the cache. Suited to large
+	// fills of framebuffers and DDR windows that are not read back soon.
+	access_non_temporal,
+
+	// Exactly one access of the requested width per element, for
+	// registers that do not tolerate wider or merged accesses.
+	access_exact
+};
+
+
+void memory_ops_init();
+const char* memory_ops_isa();
+
+void memory_fill(void* ptr, uint32_t width, uint64_t count, uint64_t value, uint64_t increment, access_mode mode);
+
+// Returns the index of the first element that differs from the sequence
+// value, value + increment, ... in any of the bits set in mask, or count
+// if all elements match.
+uint64_t memory_find_mismatch(const void* ptr, uint32_t width, uint64_t count, uint64_t value, uint64_t increment, uint64_t mask, access_mode mode);
+
+// Returns the index of the first element that differs from the element at
+// the same index in expected, or count if all elements match.
+uint64_t memory_find_difference(const void* ptr, const void* expected, uint32_t width, uint64_t count, access_mode mode);
+
+// Copies count elements of the given width. The ranges must not overlap.
+void memory_copy(void* dst, const void* src, uint32_t width, uint64_t count, access_mode mode);
+
+// As memory_copy, but the ranges may overlap
+void memory_move(void* dst, const void* src, uint32_t width, uint64_t count, access_mode mode);
+
+// As memory_move, for ranges that overlap through different mappings of the
+// same memory, where the pointers cannot tell the safe copy direction.
+// Copies element by element, from the end if backward is set.
+void memory_move_aliased(void* dst, const void* src, uint32_t width, uint64_t count, bool backward);
+
+
+inline uint64_t memory_read(const void* ptr, uint32_t width)
+{
+	switch (width) {
+		case 8: return *(const volatile uint8_t*)ptr;
+		case 16: return *(const volatile uint16_t*)ptr;
+		case 32: return *(const volatile uint32_t*)ptr;
+		default: return *(const volatile uint64_t*)ptr;
+	}
+}
+
+inline uint64_t width_mask(uint32_t width)
+{
+	return (width >= 64) ? ~0ULL : ((1ULL << width) - 1);
+}
+
+
+#endif
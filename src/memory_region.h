@@ -26,11 +26,11 @@
 #include <string>
 #include <cstdint>
 
+// A named view into a mapping owned by the script context's mapping pool
 class memory_region
 {
 public:
-	memory_region(const std::string& name, uint64_t address, uint64_t size);
-	~memory_region();
+	memory_region(const std::string& name, uint64_t address, uint64_t size, void* mapped_address);
 
 	std::string name() const { return _name; }
 	uint64_t address() const { return _address; }
@@ -41,10 +41,7 @@ private:
 	std::string _name;
 	uint64_t _address;
 	uint64_t _size;
-	void* _mapped_base;
 	void* _mapped_address;
-	uint64_t _mapped_size;
-	int _fd;
 };
 
 #endif
@@ -0,0 +1,215 @@
+/*
+	Copyright (c) 2017 Willem Kemp
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#include "memtest.h"
+
+#include <algorithm>
+
+
+// Expected values are generated into a buffer that stays in the cache, and
+// the region is written and verified against it with the bulk kernels.
+static const uint64_t buffer_size = 16 * 1024;
+
+struct memtest_state
+{
+	uint8_t* ptr;
+	uint64_t address;
+	uint64_t count;
+	memtest_pattern pattern;
+	uint64_t seed;
+	access_mode mode;
+	uint64_t max_failures;
+	memtest_result* result;
+};
+
+
+static void record_failure(memtest_state& state, uint64_t index, uint32_t pass, uint64_t expected, uint64_t actual)
+{
+	memtest_result& result(*state.result);
+
+	result.error_count++;
+	result.failing_bits |= expected ^ actual;
+	if (result.failures.size() < state.max_failures) {
+		result.failures.push_back({ index, pass, expected, actual });
+	}
+}
+
+static uint32_t pass_count(memtest_pattern pattern, uint32_t width)
+{
+	switch (pattern) {
+		case memtest_walking_ones:
+		case memtest_walking_zeros:
+			return width;
+		case memtest_march_c:
+			return 6;
+		default:
+			return 2;
+	}
+}
+
+static inline uint64_t xorshift64(uint64_t& state)
+{
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
+
+// Fills buffer with the expected values of elements first .. first + n - 1
+template <typename T>
+static void generate(const memtest_state& state, uint32_t pass, uint64_t first, uint64_t n, uint64_t& lfsr, T* buffer)
+{
+	switch (state.pattern) {
+		case memtest_walking_ones:
+			std::fill(buffer, buffer + n, (T)((T)1 << pass));
+			break;
+		case memtest_walking_zeros:
+			std::fill(buffer, buffer + n, (T)~((T)1 << pass));
+			break;
+		case memtest_checkerboard: {
+			T value = (pass == 0) ? (T)0x5555555555555555ULL : (T)0xaaaaaaaaaaaaaaaaULL;
+			for (uint64_t i=0; i < n; ++i) {
+				buffer[i] = ((first + i) & 1) ? (T)~value : value;
+			}
+		} break;
+		case memtest_address: {
+			T invert = (pass == 0) ? 0 : (T)~0ULL;
+			T address = state.address + first * sizeof(T);
+			for (uint64_t i=0; i < n; ++i) {
+				buffer[i] = address ^ invert;
+				address += sizeof(T);
+			}
+		} break;
+		default: {
+			T invert = (pass == 0) ? 0 : (T)~0ULL;
+			for (uint64_t i=0; i < n; ++i) {
+				buffer[i] = (T)xorshift64(lfsr) ^ invert;
+			}
+		} break;
+	}
+}
+
+// Writes the whole range, then verifies it, so that addressing faults show
+template <typename T>
+static void run_pass(memtest_state& state, uint32_t pass, T* buffer)
+{
+	const uint32_t width = sizeof(T) * 8;
+	const uint64_t block = buffer_size / sizeof(T);
+	uint64_t lfsr = state.seed;
+
+	for (uint64_t first = 0; first < state.count; first += block) {
+		uint64_t n = std::min(block, state.count - first);
+		generate(state, pass, first, n, lfsr, buffer);
+		memory_copy(state.ptr + first * sizeof(T), buffer, width, n, state.mode);
+	}
+
+	lfsr = state.seed;
+
+	for (uint64_t first = 0; first < state.count; first += block) {
+		uint64_t n = std::min(block, state.count - first);
+		const uint8_t* ptr = state.ptr + first * sizeof(T);
+		generate(state, pass, first, n, lfsr, buffer);
+
+		for (uint64_t i = 0; ; ++i) {
+			i += memory_find_difference(ptr + i * sizeof(T), buffer + i, width, n - i, state.mode);
+			if (i >= n) {
+				break;
+			}
+			record_failure(state, first + i, pass, buffer[i], memory_read(ptr + i * sizeof(T), width));
+		}
+	}
+}
+
+// One read-then-write march element over all elements, upwards or downwards
+template <typename T, typename P>
+static void march_element(memtest_state& state, uint32_t pass, P* p, bool up, T expected, T value)
+{
+	for (uint64_t n = 0; n < state.count; ++n) {
+		uint64_t i = up ? n : state.count - 1 - n;
+		T actual = p[i];
+		if (actual != expected) {
+			record_failure(state, i, pass, expected, actual);
+		}
+		p[i] = value;
+	}
+}
+
+template <typename T, typename P>
+static void march_c(memtest_state& state)
+{
+	const uint32_t width = sizeof(T) * 8;
+	const T ones = (T)~0ULL;
+	P* p = (P*)state.ptr;
+
+	memory_fill(state.ptr, width, state.count, 0, 0, state.mode);
+	march_element<T>(state, 1, p, true, 0, ones);
+	march_element<T>(state, 2, p, true, ones, 0);
+	march_element<T>(state, 3, p, false, 0, ones);
+	march_element<T>(state, 4, p, false, ones, 0);
+
+	for (uint64_t i = 0; ; ++i) {
+		i += memory_find_mismatch(state.ptr + i * sizeof(T), width, state.count - i, 0, 0, ones, state.mode);
+		if (i >= state.count) {
+			break;
+		}
+		record_failure(state, i, 5, 0, memory_read(state.ptr + i * sizeof(T), width));
+	}
+}
+
+template <typename T>
+static void run(memtest_state& state)
+{
+	if (state.pattern == memtest_march_c) {
+		// The read-then-write elements run per element by definition
+		if (state.mode == access_exact) {
+			march_c<T, volatile T>(state);
+		} else {
+			march_c<T, T>(state);
+		}
+		return;
+	}
+
+	std::vector<T> buffer(buffer_size / sizeof(T));
+	for (uint32_t pass = 0; pass < state.result->passes; ++pass) {
+		run_pass(state, pass, buffer.data());
+	}
+}
+
+
+void memtest_run(void* ptr, uint64_t address, uint32_t width, uint64_t count, memtest_pattern pattern, uint64_t seed,
+	access_mode mode, uint64_t max_failures, memtest_result& result)
+{
+	// xorshift64 never leaves the all zero state
+	memtest_state state = { (uint8_t*)ptr, address, count, pattern, seed ? seed : 1, mode, max_failures, &result };
+
+	result.passes = pass_count(pattern, width);
+	result.error_count = 0;
+	result.failing_bits = 0;
+	result.failures.clear();
+
+	switch (width) {
+		case 8: run<uint8_t>(state); break;
+		case 16: run<uint16_t>(state); break;
+		case 32: run<uint32_t>(state); break;
+		default: run<uint64_t>(state); break;
+	}
+}
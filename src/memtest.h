@@ -0,0 +1,78 @@
+/*
+	Copyright (c) 2017 Willem Kemp
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#ifndef MEMTEST_H
+#define MEMTEST_H
+
+#include "memory_ops.h"
+
+#include <cstdint>
+#include <vector>
+
+
+enum memtest_pattern : uint32_t
+{
+	// One pass per bit, every element holds only that bit set (or cleared)
+	memtest_walking_ones,
+	memtest_walking_zeros,
+
+	// Alternating 0x55.. and 0xaa.. elements, then the inverse
+	memtest_checkerboard,
+
+	// March C-: w0; up(r0,w1); up(r1,w0); down(r0,w1); down(r1,w0); r0
+	memtest_march_c,
+
+	// Every element holds its own physical address, then its inverse
+	memtest_address,
+
+	// A seeded xorshift64 sequence, then its inverse
+	memtest_lfsr
+};
+
+struct memtest_failure
+{
+	uint64_t index;
+	uint32_t pass;
+	uint64_t expected;
+	uint64_t actual;
+};
+
+struct memtest_result
+{
+	uint32_t passes;
+	uint64_t error_count;
+
+	// The bits that differed in any failure
+	uint64_t failing_bits;
+
+	// The first failures, up to the requested maximum
+	std::vector<memtest_failure> failures;
+};
+
+
+// Tests count elements of the given width at ptr. address is the physical
+// address of the first element and is used by memtest_address.
+void memtest_run(void* ptr, uint64_t address, uint32_t width, uint64_t count, memtest_pattern pattern, uint64_t seed,
+	access_mode mode, uint64_t max_failures, memtest_result& result);
+
+
+#endif
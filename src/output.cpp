@@ -0,0 +1,176 @@
+/*
+	Copyright (c) 2017 Willem Kemp
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#include "output.h"
+#include "textutils.h"
+
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+
+
+static const size_t buffer_size = 1024 * 1024;
+
+static char buffer[buffer_size];
+static size_t buffer_used = 0;
+static output_format current_format = output_text;
+static thread_local std::string* capture = nullptr;
+
+
+static void write_all(const char* data, size_t size)
+{
+	size_t written = 0;
+
+	while (written < size) {
+		ssize_t result = write(STDOUT_FILENO, data + written, size - written);
+		if (result <= 0) {
+			break;
+		}
+		written += result;
+	}
+}
+
+
+void output_init()
+{
+	atexit(output_flush);
+}
+
+void output_flush()
+{
+	if (capture) {
+		return;
+	}
+
+	write_all(buffer, buffer_used);
+	buffer_used = 0;
+}
+
+void output_set_format(output_format format)
+{
+	current_format = format;
+}
+
+output_format output_get_format()
+{
+	return current_format;
+}
+
+void output_capture(std::string* str)
+{
+	capture = str;
+}
+
+void output_write(const char* data, size_t size)
+{
+	if (capture) {
+		capture->append(data, size);
+		return;
+	}
+
+	if (buffer_used + size > buffer_size) {
+		output_flush();
+
+		// Too large to buffer, write through
+		if (size > buffer_size) {
+			write_all(data, size);
+			return;
+		}
+	}
+
+	memcpy(buffer + buffer_used, data, size);
+	buffer_used += size;
+}
+
+void output_write(const std::string& str)
+{
+	output_write(str.data(), str.size());
+}
+
+void output_write(char c)
+{
+	if (capture) {
+		capture->push_back(c);
+		return;
+	}
+
+	if (buffer_used == buffer_size) {
+		output_flush();
+	}
+
+	buffer[buffer_used++] = c;
+}
+
+void output_write_hex(uint64_t value)
+{
+	char text[32];
+	size_t length = tu::format_uint(text, value, 16, 0, false, false);
+	output_write(text, length);
+}
+
+void output_write_dec(uint64_t value)
+{
+	char text[32];
+	size_t length = tu::format_uint(text, value, 10, 0, false, false);
+	output_write(text, length);
+}
+
+void output_write_json_string(const std::string& str)
+{
+	static const char digits[] = "0123456789abcdef";
+
+	output_write('"');
+
+	for (char c : str) {
+		switch (c) {
+			case '"': output_write("\\\"", 2); break;
+			case '\\': output_write("\\\\", 2); break;
+			case '\n': output_write("\\n", 2); break;
+			case '\r': output_write("\\r", 2); break;
+			case '\t': output_write("\\t", 2); break;
+			default: {
+				if ((unsigned char)c < 0x20) {
+					char escape[6] = { '\\', 'u', '0', '0', digits[(c >> 4) & 0xf], digits[c & 0xf] };
+					output_write(escape, sizeof(escape));
+				} else {
+					output_write(c);
+				}
+			}
+		}
+	}
+
+	output_write('"');
+}
+
+void output_write_csv_string(const std::string& str)
+{
+	output_write('"');
+
+	for (char c : str) {
+		if (c == '"') {
+			output_write('"');
+		}
+		output_write(c);
+	}
+
+	output_write('"');
+}
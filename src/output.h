@@ -0,0 +1,64 @@
+/*
+	Copyright (c) 2017 Willem Kemp
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+
+// Script results (read_value, print and compare_memory reports) are
+// collected in a large buffer and written to stdout when it fills up, on
+// explicit flushes, before log lines and at exit.
+
+enum output_format : uint32_t
+{
+	output_text,
+	output_jsonl,
+	output_csv
+};
+
+
+void output_init();
+void output_flush();
+
+void output_set_format(output_format format);
+output_format output_get_format();
+
+// Collects the output of the calling thread in str instead of the shared
+// buffer, until called with nullptr. Flushes are ignored meanwhile.
+void output_capture(std::string* str);
+
+void output_write(const char* data, size_t size);
+void output_write(const std::string& str);
+void output_write(char c);
+void output_write_hex(uint64_t value);
+void output_write_dec(uint64_t value);
+
+// Writes a string as a quoted JSON or CSV field
+void output_write_json_string(const std::string& str);
+void output_write_csv_string(const std::string& str);
+
+
+#endif
@@ -0,0 +1,134 @@
+/*
+	Copyright (c) 2017 Willem Kemp
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#ifndef POLLING_H
+#define POLLING_H
+
+#include <cstdint>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+
+enum poll_strategy : uint32_t
+{
+	// Busy-wait with a pause instruction between reads
+	poll_spin,
+
+	// Spin for spin_ns, then yield the CPU between reads
+	poll_spin_yield,
+
+	// Spin for spin_ns, then sleep between reads, doubling the sleep
+	// every time up to interval_ns
+	poll_backoff,
+
+	// Sleep interval_ns between reads
+	poll_sleep
+};
+
+struct poll_options
+{
+	poll_strategy strategy;
+	uint64_t spin_ns;
+	uint64_t interval_ns;
+};
+
+struct poll_result
+{
+	bool satisfied;
+	uint64_t iterations;
+	uint64_t elapsed_ns;
+};
+
+
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	_mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+inline uint64_t monotonic_ns()
+{
+	auto now = std::chrono::steady_clock::now().time_since_epoch();
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+
+// Calls condition until it returns true or timeout_ns has passed
+template <typename Condition>
+poll_result poll_until(Condition condition, uint64_t timeout_ns, const poll_options& options)
+{
+	poll_result result = { false, 0, 0 };
+	uint64_t start = monotonic_ns();
+	uint64_t sleep_ns = 1000;
+
+	for (;;) {
+		result.iterations++;
+
+		if (condition()) {
+			result.satisfied = true;
+			break;
+		}
+
+		uint64_t elapsed = monotonic_ns() - start;
+		if (elapsed > timeout_ns) {
+			break;
+		}
+
+		switch (options.strategy) {
+			case poll_spin: {
+				cpu_relax();
+			} break;
+			case poll_spin_yield: {
+				if (elapsed < options.spin_ns) {
+					cpu_relax();
+				} else {
+					std::this_thread::yield();
+				}
+			} break;
+			case poll_backoff: {
+				if (elapsed < options.spin_ns) {
+					cpu_relax();
+				} else {
+					std::this_thread::sleep_for(std::chrono::nanoseconds(std::min(sleep_ns, timeout_ns - elapsed)));
+					sleep_ns = std::min(sleep_ns * 2, options.interval_ns);
+				}
+			} break;
+			case poll_sleep: {
+				std::this_thread::sleep_for(std::chrono::nanoseconds(options.interval_ns));
+			} break;
+		}
+	}
+
+	result.elapsed_ns = monotonic_ns() - start;
+	return result;
+}
+
+
+#endif
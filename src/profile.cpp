@@ -0,0 +1,176 @@
+/*
+	Copyright (c) 2017 Willem Kemp
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#include "profile.h"
+#include "commands.h"
+#include "program.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+
+bool profile_enabled = false;
+thread_local uint64_t profile_bytes = 0;
+
+struct profile_entry
+{
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t max_ns;
+	uint64_t bytes;
+};
+
+// Parallel blocks record from several threads
+static std::mutex mutex;
+static std::map<std::pair<uint64_t, uint16_t>, profile_entry> locations;
+
+
+static void add(profile_entry& entry, uint64_t count, uint64_t total_ns, uint64_t max_ns, uint64_t bytes)
+{
+	entry.count += count;
+	entry.total_ns += total_ns;
+	entry.max_ns = std::max(entry.max_ns, max_ns);
+	entry.bytes += bytes;
+}
+
+void profile_record(uint64_t location, uint16_t op, uint64_t elapsed_ns, uint64_t bytes)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	add(locations[std::make_pair(location, op)], 1, elapsed_ns, elapsed_ns, bytes);
+}
+
+// Converts byte offsets into line:column, using the script text if available
+class location_formatter
+{
+public:
+	location_formatter(const std::string& script_file)
+	{
+		if (script_file.empty()) {
+			return;
+		}
+
+		std::ifstream file(script_file);
+		std::string line;
+		uint64_t offset = 0;
+		while (std::getline(file, line)) {
+			_line_starts.push_back(offset);
+			offset += line.size() + 1;
+		}
+	}
+
+	std::string format(uint64_t offset) const
+	{
+		std::ostringstream text;
+		if (offset == no_location) {
+			text << "-";
+		} else if (_line_starts.empty()) {
+			text << "offset " << offset;
+		} else {
+			auto line = std::upper_bound(_line_starts.begin(), _line_starts.end(), offset) - 1;
+			text << (line - _line_starts.begin() + 1) << ":" << (offset - *line + 1);
+		}
+		return text.str();
+	}
+
+private:
+	std::vector<uint64_t> _line_starts;
+};
+
+struct report_row
+{
+	std::string location;
+	std::string command;
+	profile_entry entry;
+};
+
+static bool by_total_time(const report_row& a, const report_row& b)
+{
+	return a.entry.total_ns > b.entry.total_ns;
+}
+
+static void write_text(FILE* file, const char* title, const std::vector<report_row>& rows)
+{
+	std::fprintf(file, "%s\n", title);
+	std::fprintf(file, "%-16s %-22s %10s %14s %12s %12s %14s\n", "location", "command", "count", "total_us", "avg_us", "max_us", "bytes");
+
+	for (const report_row& row : rows) {
+		std::fprintf(file, "%-16s %-22s %10llu %14.1f %12.2f %12.1f %14llu\n", row.location.c_str(), row.command.c_str(),
+			(unsigned long long)row.entry.count, row.entry.total_ns / 1e3, row.entry.total_ns / 1e3 / row.entry.count,
+			row.entry.max_ns / 1e3, (unsigned long long)row.entry.bytes);
+	}
+}
+
+static void write_json(std::ostream& stream, const std::vector<report_row>& rows, bool with_location)
+{
+	stream << "[";
+	for (size_t i=0; i < rows.size(); ++i) {
+		const report_row& row(rows[i]);
+		stream << (i ? ",\n" : "\n") << "\t\t{ ";
+		if (with_location) {
+			stream << "\"location\": \"" << row.location << "\", ";
+		}
+		stream << "\"command\": \"" << row.command << "\", \"count\": " << row.entry.count << ", \"total_ns\": " << row.entry.total_ns
+			<< ", \"max_ns\": " << row.entry.max_ns << ", \"bytes\": " << row.entry.bytes << " }";
+	}
+	stream << "\n\t]";
+}
+
+void profile_report(const std::string& json_file, const std::string& script_file)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	location_formatter formatter(script_file);
+
+	std::vector<report_row> by_location;
+	std::map<uint16_t, profile_entry> commands;
+
+	for (const auto& i : locations) {
+		by_location.push_back({ formatter.format(i.first.first), opcode_name(i.first.second), i.second });
+		add(commands[i.first.second], i.second.count, i.second.total_ns, i.second.max_ns, i.second.bytes);
+	}
+
+	std::vector<report_row> by_command;
+	for (const auto& i : commands) {
+		by_command.push_back({ "", opcode_name(i.first), i.second });
+	}
+
+	std::stable_sort(by_location.begin(), by_location.end(), by_total_time);
+	std::stable_sort(by_command.begin(), by_command.end(), by_total_time);
+
+	if (json_file.empty()) {
+		write_text(stderr, "profile by location (times include nested commands):", by_location);
+		std::fprintf(stderr, "\n");
+		write_text(stderr, "profile by command:", by_command);
+		return;
+	}
+
+	std::ofstream file(json_file);
+	file << "{\n\t\"locations\": ";
+	write_json(file, by_location, true);
+	file << ",\n\t\"commands\": ";
+	write_json(file, by_command, false);
+	file << "\n}\n";
+}
@@ -0,0 +1,51 @@
+/*
+	Copyright (c) 2017 Willem Kemp
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <cstdint>
+#include <string>
+
+
+// With profiling enabled, every executed command is timed and accounted to
+// its location in the script and to its command type. When disabled, the
+// only cost is the check of profile_enabled per command.
+extern bool profile_enabled;
+
+// Bytes moved by the commands running on this thread
+extern thread_local uint64_t profile_bytes;
+
+inline void profile_count_bytes(uint64_t bytes)
+{
+	profile_bytes += bytes;
+}
+
+void profile_record(uint64_t location, uint16_t op, uint64_t elapsed_ns, uint64_t bytes);
+
+// Writes the hot spots sorted by total time, as text to stderr, or as JSON
+// to json_file if given. Locations are given as line:column if the script
+// file is known, as byte offsets otherwise.
+void profile_report(const std::string& json_file, const std::string& script_file);
+
+
+#endif
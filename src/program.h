@@ -0,0 +1,352 @@
+/*
+	Copyright (c) 2017 Willem Kemp
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include "memory_ops.h"
+#include "checksum.h"
+#include "memtest.h"
+#include "mapping_pool.h"
+#include "polling.h"
+#include <jsoncpp/json/json.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+// A script is lowered once into a flat list of instructions before it runs.
+// Names are resolved to slots and fields are pre-parsed, so the interpreter
+// never touches the JSON tree or does string lookups per command.
+
+enum opcode : uint16_t
+{
+	op_set_config,
+	op_declare_memory_region,
+	op_set_variable,
+	op_write_value,
+	op_read_value,
+	op_poll_value,
+	op_delay,
+	op_print,
+	op_assert,
+	op_compare_memory,
+	op_repeat,
+	op_wait,
+	op_flush,
+	op_dump_memory,
+	op_load_memory,
+	op_copy_memory,
+	op_checksum_memory,
+	op_memtest,
+	op_parallel,
+	op_block,
+	op_count
+};
+
+enum config_option : uint32_t
+{
+	config_loglevel,
+	config_output_format,
+	config_log_async,
+	config_threads,
+	config_cpus
+};
+
+
+// Index of a string in program::strings
+typedef uint32_t string_ref;
+
+// Marks an optional variable or region slot that is not used
+static const uint32_t no_slot = 0xffffffff;
+
+// Location of an instruction that has no command of its own in the script
+static const uint64_t no_location = ~uint64_t(0);
+
+
+// Expressions are compiled into postfix code that runs on a small value
+// stack. Operators with a constant right operand carry it as an immediate.
+enum expression_opcode : uint16_t
+{
+	eop_constant,
+	eop_variable,
+	eop_and,
+	eop_or,
+	eop_not,
+	eop_shl,
+	eop_shr,
+	eop_and_immediate,
+	eop_or_immediate,
+	eop_shl_immediate,
+	eop_shr_immediate
+};
+
+struct expression_op
+{
+	uint16_t code;
+	uint32_t index;
+	uint64_t value;
+};
+
+
+// A compiled expression field. Constants and plain identifiers are
+// evaluated without running any code; anything else refers to a range
+// of program::expression_code.
+enum operand_kind : uint32_t
+{
+	operand_constant,
+	operand_variable,
+	operand_expression
+};
+
+struct operand
+{
+	uint32_t kind;
+	uint32_t index;
+	uint64_t value;
+};
+
+
+struct set_config_args
+{
+	uint32_t option;
+	int64_t value;
+};
+
+struct declare_memory_region_args
+{
+	uint32_t region;
+	uint64_t address;
+	uint64_t size;
+	mapping_options options;
+};
+
+struct set_variable_args
+{
+	uint32_t variable;
+	operand value;
+};
+
+struct write_value_args
+{
+	uint32_t region;
+	uint32_t width;
+	operand offset;
+	operand value;
+	operand value_increment;
+	int64_t count;
+	access_mode access;
+};
+
+struct read_value_args
+{
+	uint32_t region;
+	uint32_t width;
+	operand offset;
+	uint32_t variable;
+	string_ref display_prefix;
+};
+
+struct poll_value_args
+{
+	uint32_t region;
+	uint32_t width;
+	operand offset;
+	operand mask;
+	bool condition;
+	uint64_t timeout_ns;
+	poll_options poll;
+};
+
+struct delay_args
+{
+	int64_t us;
+};
+
+// A piece of a print message: either literal text, or a placeholder that
+// formats one of the arguments
+struct print_segment
+{
+	uint32_t argument;
+	string_ref text;
+	uint8_t base;
+	uint8_t width;
+	bool zero_pad;
+	bool upper;
+};
+
+struct print_args
+{
+	uint32_t first_segment;
+	uint32_t segment_count;
+	uint32_t first_argument;
+	uint32_t argument_count;
+};
+
+struct assert_args
+{
+	operand variable;
+	operand value;
+	bool condition;
+};
+
+struct compare_memory_args
+{
+	uint32_t region;
+	uint32_t width;
+	operand offset;
+	operand value;
+	operand value_increment;
+	operand mask;
+	int64_t count;
+	int64_t max_error_count;
+	access_mode access;
+	uint32_t error_variable;
+	uint32_t range_variable;
+};
+
+struct repeat_args
+{
+	uint32_t variable;
+	operand count;
+	operand start;
+	operand step;
+};
+
+struct wait_condition
+{
+	uint32_t region;
+	uint32_t width;
+	operand offset;
+	operand mask;
+	bool condition;
+};
+
+struct wait_args
+{
+	bool all;
+	uint32_t first_condition;
+	uint32_t condition_count;
+	uint32_t fired_variable;
+	uint32_t elapsed_variable;
+	uint64_t timeout_ns;
+	poll_options poll;
+};
+
+struct dump_memory_args
+{
+	uint32_t region;
+	operand offset;
+	operand size;
+	string_ref file;
+};
+
+struct load_memory_args
+{
+	uint32_t region;
+	operand offset;
+	string_ref file;
+	uint32_t width;
+	access_mode access;
+};
+
+struct copy_memory_args
+{
+	uint32_t source_region;
+	operand source_offset;
+	uint32_t destination_region;
+	operand destination_offset;
+	operand size;
+	uint32_t width;
+	access_mode access;
+};
+
+struct checksum_memory_args
+{
+	uint32_t region;
+	operand offset;
+	operand size;
+	checksum_algorithm algorithm;
+	uint32_t variable;
+	bool check;
+	operand value;
+	bool condition;
+};
+
+struct memtest_args
+{
+	uint32_t region;
+	operand offset;
+	operand size;
+	uint32_t width;
+	memtest_pattern pattern;
+	operand seed;
+	access_mode access;
+	uint32_t max_failures;
+	uint32_t error_variable;
+};
+
+
+struct instruction
+{
+	opcode op;
+
+	// Number of instructions directly following this one that form its body
+	uint32_t block_size;
+
+	union {
+		set_config_args set_config;
+		declare_memory_region_args declare_memory_region;
+		set_variable_args set_variable;
+		write_value_args write_value;
+		read_value_args read_value;
+		poll_value_args poll_value;
+		delay_args delay;
+		print_args print;
+		assert_args assertion;
+		compare_memory_args compare_memory;
+		repeat_args repeat;
+		wait_args wait;
+		dump_memory_args dump_memory;
+		load_memory_args load_memory;
+		copy_memory_args copy_memory;
+		checksum_memory_args checksum_memory;
+		memtest_args memtest;
+	};
+};
+
+
+struct program
+{
+	std::vector<instruction> instructions;
+	std::vector<expression_op> expression_code;
+	std::vector<std::string> strings;
+	std::vector<operand> arguments;
+	std::vector<print_segment> print_segments;
+	std::vector<wait_condition> wait_conditions;
+
+	// Byte offset of each command in the script, for --profile
+	std::vector<uint64_t> locations;
+};
+
+
+#endif
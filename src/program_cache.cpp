@@ -0,0 +1,388 @@
+/*
+	Copyright (c) 2017 Willem Kemp
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#include "program_cache.h"
+#include "commands.h"
+#include "checksum.h"
+#include "script_exception.h"
+#include "logging.h"
+
+#include <jsoncpp/json/json.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <set>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// Bump when the meaning of program or any instruction changes. Layout
+// changes are caught by the fingerprint as well.
+static const uint32_t cache_format_version = 2;
+static const char cache_magic[8] = { 'A', 'G', 'M', 'N', 'P', 'R', 'O', 'G' };
+
+struct cache_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t instruction_size;
+	uint32_t opcode_count;
+	uint32_t reserved;
+	uint64_t layout_fingerprint;
+
+	uint64_t source_size;
+	int64_t source_mtime_ns;
+	uint64_t source_hash;
+
+	uint64_t instruction_count;
+	uint64_t expression_op_count;
+	uint64_t argument_count;
+	uint64_t print_segment_count;
+	uint64_t wait_condition_count;
+	uint64_t location_count;
+	uint64_t string_count;
+	uint64_t region_name_count;
+	uint64_t variable_name_count;
+
+	uint64_t file_size;
+
+	// Hash of everything after the header, so corruption is not executed
+	uint64_t payload_hash;
+};
+
+struct source_key
+{
+	uint64_t size;
+	int64_t mtime_ns;
+};
+
+
+// Hash of the size and field offsets of every type stored in the cache
+static uint64_t layout_fingerprint()
+{
+	const uint64_t layout[] = {
+		sizeof(instruction), offsetof(instruction, block_size), offsetof(instruction, set_config),
+		sizeof(set_config_args), sizeof(declare_memory_region_args), sizeof(set_variable_args),
+		sizeof(write_value_args), sizeof(read_value_args), sizeof(poll_value_args), sizeof(delay_args),
+		sizeof(print_args), sizeof(assert_args), sizeof(compare_memory_args), sizeof(repeat_args),
+		sizeof(wait_args), sizeof(dump_memory_args), sizeof(load_memory_args), sizeof(copy_memory_args),
+		sizeof(checksum_memory_args), sizeof(memtest_args), sizeof(mapping_options), sizeof(poll_options),
+		sizeof(expression_op), offsetof(expression_op, index), offsetof(expression_op, value),
+		sizeof(operand), offsetof(operand, index), offsetof(operand, value),
+		sizeof(print_segment), offsetof(print_segment, text), offsetof(print_segment, base),
+		sizeof(wait_condition), offsetof(wait_condition, offset), offsetof(wait_condition, mask), offsetof(wait_condition, condition),
+		sizeof(uint64_t), op_count, eop_shr_immediate, memtest_lfsr, checksum_xxh64, access_exact, poll_sleep, config_cpus
+	};
+
+	return checksum_compute(checksum_xxh64, layout, sizeof(layout));
+}
+
+static uint64_t align8(uint64_t value)
+{
+	return (value + 7) & ~7ULL;
+}
+
+template <typename T>
+static void append_array(std::string& data, const std::vector<T>& items)
+{
+	data.append((const char*)items.data(), items.size() * sizeof(T));
+	data.resize(align8(data.size()));
+}
+
+static void append_strings(std::string& data, const std::vector<std::string>& strings)
+{
+	for (const std::string& str : strings) {
+		uint64_t length = str.size();
+		data.append((const char*)&length, sizeof(length));
+		data.append(str);
+		data.resize(align8(data.size()));
+	}
+}
+
+// Reads sections from a mapped cache file, checking every access against its size
+class cache_reader
+{
+public:
+	cache_reader(const uint8_t* data, uint64_t size, uint64_t position) : _data(data), _size(size), _position(position) {}
+
+	template <typename T>
+	void read_array(std::vector<T>& items, uint64_t count)
+	{
+		const uint8_t* ptr = take(count * sizeof(T));
+		items.resize(count);
+		memcpy(items.data(), ptr, count * sizeof(T));
+	}
+
+	void read_strings(std::vector<std::string>& strings, uint64_t count)
+	{
+		strings.resize(count);
+		for (std::string& str : strings) {
+			uint64_t length;
+			memcpy(&length, take(sizeof(length)), sizeof(length));
+			str.assign((const char*)take(length), length);
+		}
+	}
+
+private:
+	const uint8_t* take(uint64_t size)
+	{
+		if (size > _size - _position) {
+			throw script_exception("truncated program cache");
+		}
+		const uint8_t* ptr = _data + _position;
+		_position = std::min(_size, align8(_position + size));
+		return ptr;
+	}
+
+	const uint8_t* _data;
+	uint64_t _size;
+	uint64_t _position;
+};
+
+
+static std::string read_source(const std::string& script_file)
+{
+	int fd = open(script_file.c_str(), O_RDONLY);
+	if (fd == -1) {
+		throw script_exception(fmt() << "could not open " << script_file << ": " << strerror(errno));
+	}
+
+	std::string text;
+	char buffer[65536];
+	ssize_t result;
+	while ((result = read(fd, buffer, sizeof(buffer))) > 0 || (result < 0 && errno == EINTR)) {
+		if (result > 0) {
+			text.append(buffer, result);
+		}
+	}
+	close(fd);
+
+	return text;
+}
+
+static bool header_matches_build(const cache_header& header, uint64_t file_size)
+{
+	return file_size >= sizeof(cache_header) &&
+		memcmp(header.magic, cache_magic, sizeof(cache_magic)) == 0 &&
+		header.version == cache_format_version &&
+		header.instruction_size == sizeof(instruction) &&
+		header.opcode_count == op_count &&
+		header.layout_fingerprint == layout_fingerprint() &&
+		header.file_size == file_size;
+}
+
+// Loads the cached program if it is still valid for the source. Names are
+// bound in slot order, so the context must not have bound any yet.
+static bool load_cache(const std::string& cache_file, const std::string& script_file, const source_key& key,
+	std::string& source, bool& source_read, program& program, script_context& script_context)
+{
+	int fd = open(cache_file.c_str(), O_RDONLY);
+	if (fd == -1) {
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == -1 || (uint64_t)st.st_size < sizeof(cache_header)) {
+		close(fd);
+		return false;
+	}
+
+	uint64_t file_size = st.st_size;
+	const uint8_t* data = (const uint8_t*)mmap(0, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+
+	cache_header header;
+	memcpy(&header, data, sizeof(header));
+	bool valid = header_matches_build(header, file_size);
+
+	// A changed timestamp alone does not invalidate the cache
+	if (valid && (header.source_size != key.size || header.source_mtime_ns != key.mtime_ns)) {
+		if (!source_read) {
+			source = read_source(script_file);
+			source_read = true;
+		}
+		valid = header.source_size == source.size() &&
+			header.source_hash == checksum_compute(checksum_xxh64, source.data(), source.size());
+	}
+
+	if (valid && (script_context.memory_region_count() != 0 || script_context.variable_count() != 0)) {
+		valid = false;
+	}
+
+	uint64_t payload_offset = align8(sizeof(cache_header));
+	if (valid && header.payload_hash != checksum_compute(checksum_xxh64, data + payload_offset, file_size - payload_offset)) {
+		LOG(ll_v) << "program cache: " << cache_file << ": corrupt";
+		valid = false;
+	}
+
+	if (valid) {
+		try {
+			cache_reader reader(data, file_size, payload_offset);
+			std::vector<std::string> region_names;
+			std::vector<std::string> variable_names;
+
+			reader.read_array(program.instructions, header.instruction_count);
+			reader.read_array(program.expression_code, header.expression_op_count);
+			reader.read_array(program.arguments, header.argument_count);
+			reader.read_array(program.print_segments, header.print_segment_count);
+			reader.read_array(program.wait_conditions, header.wait_condition_count);
+			reader.read_array(program.locations, header.location_count);
+			reader.read_strings(program.strings, header.string_count);
+			reader.read_strings(region_names, header.region_name_count);
+			reader.read_strings(variable_names, header.variable_name_count);
+
+			program_validate(program, region_names.size(), variable_names.size());
+
+			// Slots are bound in order, so every name must be new
+			if (std::set<std::string>(region_names.begin(), region_names.end()).size() != region_names.size() ||
+				std::set<std::string>(variable_names.begin(), variable_names.end()).size() != variable_names.size()) {
+				throw script_exception("duplicate names in program cache");
+			}
+
+			for (const std::string& name : region_names) {
+				script_context.bind_memory_region(name);
+			}
+			for (const std::string& name : variable_names) {
+				script_context.bind_variable(name);
+			}
+
+			// Redo the reservations compiling the regions made
+			for (const instruction& instruction : program.instructions) {
+				if (instruction.op == op_declare_memory_region) {
+					const declare_memory_region_args& args(instruction.declare_memory_region);
+					script_context.get_mapping_pool().reserve(args.address, args.size, args.options);
+				}
+			}
+
+		} catch (script_exception& e) {
+			LOG(ll_v) << "program cache: " << cache_file << ": " << e.what();
+			program = ::program();
+			valid = false;
+		}
+	}
+
+	munmap((void*)data, file_size);
+	return valid;
+}
+
+static void save_cache(const std::string& cache_file, const source_key& key, const std::string& source,
+	const program& program, const script_context& script_context)
+{
+	std::vector<std::string> region_names;
+	for (uint32_t i=0; i < script_context.memory_region_count(); ++i) {
+		region_names.push_back(script_context.memory_region_name(i));
+	}
+
+	std::vector<std::string> variable_names;
+	for (uint32_t i=0; i < script_context.variable_count(); ++i) {
+		variable_names.push_back(script_context.variable_name(i));
+	}
+
+	cache_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, cache_magic, sizeof(cache_magic));
+	header.version = cache_format_version;
+	header.instruction_size = sizeof(instruction);
+	header.opcode_count = op_count;
+	header.layout_fingerprint = layout_fingerprint();
+	header.source_size = key.size;
+	header.source_mtime_ns = key.mtime_ns;
+	header.source_hash = checksum_compute(checksum_xxh64, source.data(), source.size());
+	header.instruction_count = program.instructions.size();
+	header.expression_op_count = program.expression_code.size();
+	header.argument_count = program.arguments.size();
+	header.print_segment_count = program.print_segments.size();
+	header.wait_condition_count = program.wait_conditions.size();
+	header.location_count = program.locations.size();
+	header.string_count = program.strings.size();
+	header.region_name_count = region_names.size();
+	header.variable_name_count = variable_names.size();
+
+	std::string data(align8(sizeof(header)), 0);
+	append_array(data, program.instructions);
+	append_array(data, program.expression_code);
+	append_array(data, program.arguments);
+	append_array(data, program.print_segments);
+	append_array(data, program.wait_conditions);
+	append_array(data, program.locations);
+	append_strings(data, program.strings);
+	append_strings(data, region_names);
+	append_strings(data, variable_names);
+
+	header.file_size = data.size();
+	header.payload_hash = checksum_compute(checksum_xxh64, data.data() + align8(sizeof(header)), data.size() - align8(sizeof(header)));
+	memcpy(&data[0], &header, sizeof(header));
+
+	// Write to a temporary file and rename it, so readers never see a partial cache
+	std::string temporary_file = cache_file + ".tmp";
+	int fd = open(temporary_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		LOG(ll_v) << "program cache: could not create " << temporary_file << ": " << strerror(errno);
+		return;
+	}
+
+	bool written = write(fd, data.data(), data.size()) == (ssize_t)data.size();
+	close(fd);
+
+	if (!written || rename(temporary_file.c_str(), cache_file.c_str()) == -1) {
+		LOG(ll_v) << "program cache: could not write " << cache_file;
+		unlink(temporary_file.c_str());
+	}
+}
+
+void program_load_cached(const std::string& script_file, program& program, script_context& script_context)
+{
+	struct stat st;
+	if (stat(script_file.c_str(), &st) == -1) {
+		throw script_exception(fmt() << "could not open " << script_file << ": " << strerror(errno));
+	}
+
+	source_key key = { (uint64_t)st.st_size, (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec };
+	std::string cache_file = script_file + ".agc";
+	std::string source;
+	bool source_read = false;
+
+	if (load_cache(cache_file, script_file, key, source, source_read, program, script_context)) {
+		LOG(ll_v) << "program cache: loaded " << cache_file;
+		return;
+	}
+
+	if (!source_read) {
+		source = read_source(script_file);
+	}
+
+	Json::Value root;
+	Json::Reader reader;
+	if (!reader.parse(source, root)) {
+		throw script_exception(reader.getFormattedErrorMessages());
+	}
+
+	command_compile(root, program, script_context);
+	save_cache(cache_file, key, source, program, script_context);
+}
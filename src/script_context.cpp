@@ -24,59 +24,102 @@
 #include "script_exception.h"
 
 
+script_context::script_context() :
+	_owns_regions(true)
+{
+
+}
+
+script_context::script_context(const script_context* parent) :
+	_owns_regions(false),
+	_memory_regions(parent->_memory_regions),
+	_memory_region_names(parent->_memory_region_names),
+	_variables(parent->_variables),
+	_variable_names(parent->_variable_names)
+{
+
+}
+
 script_context::~script_context()
 {
+	if (!_owns_regions) {
+		return;
+	}
+
 	for (auto&& i = _memory_regions.begin(); i != _memory_regions.end(); ++i) {
-		memory_region* memory_region((*i).second);
+		memory_region* memory_region(*i);
 		delete memory_region;
 	}
 }
 
-void script_context::add_memory_region(memory_region* region)
+uint32_t script_context::bind_memory_region(const std::string& name)
 {
-	_memory_regions[region->name()] = region;
+	auto i = _memory_region_slots.find(name);
+	if (i != _memory_region_slots.end()) {
+		return (*i).second;
+	}
+
+	uint32_t slot = _memory_regions.size();
+	_memory_regions.push_back(nullptr);
+	_memory_region_names.push_back(name);
+	_memory_region_slots[name] = slot;
+
+	return slot;
 }
 
-memory_region* script_context::get_memory_region(const std::string& name) const
+uint32_t script_context::find_memory_region(const std::string& name) const
 {
-	auto i = _memory_regions.find(name);
-	if (i == _memory_regions.end()) {
-		return nullptr;
-	} else {
-		return (*i).second;
+	auto i = _memory_region_slots.find(name);
+	if (i == _memory_region_slots.end()) {
+		throw script_exception(fmt() << "memory region " << name << " not found");
 	}
+
+	return (*i).second;
 }
 
-void script_context::set_variable(const variable& variable)
+void script_context::throw_not_declared(uint32_t slot) const
 {
-	_variables[variable.name()] = variable;
+	throw script_exception(fmt() << "memory region " << _memory_region_names[slot] << " not declared");
 }
 
-uint64_t script_context::resolve_value(const std::string& value) const
+void script_context::add_memory_region(uint32_t slot, memory_region* region)
 {
-	uint64_t result = 0;
+	// Redeclaring a region replaces the previous mapping
+	delete _memory_regions[slot];
+	_memory_regions[slot] = region;
+}
 
-	if (value.length() == 0) {
-		return 0;
+uint32_t script_context::bind_variable(const std::string& name)
+{
+	auto i = _variable_slots.find(name);
+	if (i != _variable_slots.end()) {
+		return (*i).second;
 	}
 
-	// Anything that starts with an alphabetic character is considered an identifier
-	if (isalpha(value[0])) {
+	uint32_t slot = _variables.size();
+	_variables.push_back(0);
+	_variable_names.push_back(name);
+	_variable_slots[name] = slot;
 
-		auto i = _variables.find(value);
+	return slot;
+}
 
-		if (i != _variables.end()) {
-			result = (*i).second.value();
+uint32_t script_context::find_variable(const std::string& name) const
+{
+	auto i = _variable_slots.find(name);
+	if (i == _variable_slots.end()) {
+		throw script_exception(fmt() << "could not find identifier: " << name);
+	}
 
-		} else {
-			throw script_exception(fmt() << "could not find identifier: " << value);
-		}
+	return (*i).second;
+}
 
-	// Else parse as a number
-	} else {
-		size_t pos;
-		result = std::stoull(value, &pos, 0);
+void script_context::unbind_variables(uint32_t count)
+{
+	for (uint32_t slot = count; slot < _variables.size(); ++slot) {
+		_variable_slots.erase(_variable_names[slot]);
 	}
 
-	return result;
+	_variables.resize(count);
+	_variable_names.resize(count);
 }
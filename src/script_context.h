@@ -25,25 +25,70 @@
 
 
 #include "memory_region.h"
-#include "variable.h"
+#include "mapping_pool.h"
 #include <map>
+#include <vector>
 
 
 class script_context
 {
 public:
+	script_context();
+
+	// A context for one block of a parallel command. It shares the memory
+	// regions of parent, which must outlive it, and starts with a copy of
+	// the parent's variables. Names cannot be bound in it.
+	explicit script_context(const script_context* parent);
+
 	~script_context();
 
-	void add_memory_region(memory_region* region);
-	memory_region* get_memory_region(const std::string& name) const;
+	uint32_t bind_memory_region(const std::string& name);
+	uint32_t find_memory_region(const std::string& name) const;
+
+	void add_memory_region(uint32_t slot, memory_region* region);
+
+	// Throws if the region has been referenced but its declaration has not run
+	memory_region* get_memory_region(uint32_t slot) const
+	{
+		memory_region* region = _memory_regions[slot];
+		if (__builtin_expect(!region, 0)) {
+			throw_not_declared(slot);
+		}
+		return region;
+	}
+
+	const std::string& memory_region_name(uint32_t slot) const { return _memory_region_names[slot]; }
+	uint32_t memory_region_count() const { return _memory_regions.size(); }
 
-	void set_variable(const variable& variable);
+	mapping_pool& get_mapping_pool() { return _mapping_pool; }
+
+	uint32_t bind_variable(const std::string& name);
+	uint32_t find_variable(const std::string& name) const;
+
+	uint64_t get_variable(uint32_t slot) const { return _variables[slot]; }
+	void set_variable(uint32_t slot, uint64_t value) { _variables[slot] = value; }
+	const std::string& variable_name(uint32_t slot) const { return _variable_names[slot]; }
+	uint32_t variable_count() const { return _variables.size(); }
+
+	// Forgets the variables bound after the first count. No compiled
+	// program may use them any more.
+	void unbind_variables(uint32_t count);
+
+private:
+	script_context(const script_context&) = delete;
+	script_context& operator =(const script_context&) = delete;
 
-	uint64_t resolve_value(const std::string& value) const;
+	[[noreturn]] void throw_not_declared(uint32_t slot) const;
 
 private:
-	std::map<std::string, memory_region*> _memory_regions;
-	std::map<std::string, variable> _variables;
+	bool _owns_regions;
+	mapping_pool _mapping_pool;
+	std::map<std::string, uint32_t> _memory_region_slots;
+	std::vector<memory_region*> _memory_regions;
+	std::vector<std::string> _memory_region_names;
+	std::map<std::string, uint32_t> _variable_slots;
+	std::vector<uint64_t> _variables;
+	std::vector<std::string> _variable_names;
 };
 
 
@@ -0,0 +1,291 @@
+/*
+	Copyright (c) 2017 Willem Kemp
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#include "stream.h"
+#include "commands.h"
+#include "script_exception.h"
+
+#include <jsoncpp/json/json.h>
+
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+
+// Tracks the JSON nesting of the input to find where each top-level
+// element ends, without parsing it. Comments are skipped as jsoncpp does,
+// but unlike it a trailing comma in the top-level array is an error.
+class element_scanner
+{
+public:
+	element_scanner(script_context& script_context) :
+		_script_context(script_context),
+		_position(0),
+		_element_start(0),
+		_element_count(0),
+		_depth(0),
+		_comment(comment_none),
+		_in_string(false),
+		_escape(false),
+		_started(false),
+		_top_array(false),
+		_finished(false)
+	{
+
+	}
+
+	void feed(const char* data, size_t size)
+	{
+		for (size_t i=0; i < size; ++i) {
+			feed(data[i]);
+			_position++;
+		}
+	}
+
+	void finish()
+	{
+		if (_comment != comment_none && _comment != comment_line) {
+			throw script_exception("unexpected end of script");
+		}
+
+		// A top-level scalar, such as a comment string, has no closing
+		// bracket; it is handled like any other script
+		if (_started && !_finished && !_top_array && _depth == 0 && !_in_string) {
+			run_element();
+			_finished = true;
+		}
+
+		if (_started && !_finished) {
+			throw script_exception("unexpected end of script");
+		}
+	}
+
+private:
+	enum comment_state
+	{
+		comment_none,
+		comment_slash,
+		comment_line,
+		comment_block,
+		comment_block_star
+	};
+
+	static bool is_space(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+	}
+
+	static bool is_blank(const std::string& str)
+	{
+		for (char c : str) {
+			if (!is_space(c)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Returns whether c is part of a // or /* */ comment
+	bool skip_comment(char c)
+	{
+		switch (_comment) {
+			case comment_none:
+				if (c != '/') {
+					return false;
+				}
+				_comment = comment_slash;
+				break;
+			case comment_slash:
+				if (c == '/') {
+					_comment = comment_line;
+				} else if (c == '*') {
+					_comment = comment_block;
+				} else {
+					throw script_exception("invalid comment in script");
+				}
+				break;
+			case comment_line:
+				if (c == '\n') {
+					_comment = comment_none;
+				}
+				break;
+			case comment_block:
+				if (c == '*') {
+					_comment = comment_block_star;
+				}
+				break;
+			case comment_block_star:
+				if (c == '/') {
+					_comment = comment_none;
+				} else if (c != '*') {
+					_comment = comment_block;
+				}
+				break;
+		}
+		return true;
+	}
+
+	void feed(char c)
+	{
+		if (_in_string) {
+			_element.push_back(c);
+			if (_escape) {
+				_escape = false;
+			} else if (c == '\\') {
+				_escape = true;
+			} else if (c == '"') {
+				_in_string = false;
+			}
+			return;
+		}
+
+		// Comments inside an element are kept so that locations still match
+		if (skip_comment(c)) {
+			if (!_element.empty()) {
+				_element.push_back(c);
+			}
+			return;
+		}
+
+		if (_finished) {
+			if (!is_space(c)) {
+				throw script_exception("unexpected data after script");
+			}
+			return;
+		}
+
+		if (!_started) {
+			if (is_space(c)) {
+				return;
+			}
+			_started = true;
+			if (c == '[') {
+				_top_array = true;
+				_depth = 1;
+				return;
+			}
+		}
+
+		// Separators of the top-level array end the current element
+		if (_top_array && _depth == 1) {
+			if (c == ',' || c == ']') {
+				if (!is_blank(_element)) {
+					run_element();
+					_element_count++;
+				} else if (c == ',' || _element_count > 0) {
+					// Only an empty array closes without an element
+					throw script_exception(fmt() << "missing element before '" << c << "' in script");
+				}
+				_element.clear();
+				_finished = (c == ']');
+				return;
+			}
+			if (is_space(c) && _element.empty()) {
+				return;
+			}
+		}
+
+		if (_element.empty()) {
+			_element_start = _position;
+		}
+		_element.push_back(c);
+
+		if (c == '"') {
+			_in_string = true;
+		} else if (c == '{' || c == '[') {
+			_depth++;
+		} else if (c == '}' || c == ']') {
+			_depth--;
+			if (!_top_array && _depth == 0) {
+				run_element();
+				_element.clear();
+				_finished = true;
+			}
+		}
+	}
+
+	void run_element()
+	{
+		Json::Value element;
+		if (!_reader.parse(_element, element, false)) {
+			throw script_exception(_reader.getFormattedErrorMessages());
+		}
+
+		// Reuse the program so its vectors keep their capacity
+		_program.instructions.clear();
+		_program.expression_code.clear();
+		_program.strings.clear();
+		_program.arguments.clear();
+		_program.print_segments.clear();
+		_program.wait_conditions.clear();
+		_program.locations.clear();
+
+		command_compile(element, _program, _script_context);
+
+		// Locations are relative to the element; make them relative to the script
+		for (uint64_t& location : _program.locations) {
+			if (location != no_location) {
+				location += _element_start;
+			}
+		}
+
+		program_execute(_program, _script_context);
+	}
+
+	script_context& _script_context;
+	Json::Reader _reader;
+	program _program;
+	std::string _element;
+	uint64_t _position;
+	uint64_t _element_start;
+	uint64_t _element_count;
+	int _depth;
+	comment_state _comment;
+	bool _in_string;
+	bool _escape;
+	bool _started;
+	bool _top_array;
+	bool _finished;
+};
+
+
+void stream_process(int fd, script_context& script_context)
+{
+	element_scanner scanner(script_context);
+	char buffer[65536];
+
+	while (true) {
+		ssize_t result = read(fd, buffer, sizeof(buffer));
+		if (result < 0 && errno == EINTR) {
+			continue;
+		}
+		if (result < 0) {
+			throw script_exception(fmt() << "could not read script: " << strerror(errno));
+		}
+		if (result == 0) {
+			break;
+		}
+		scanner.feed(buffer, result);
+	}
+
+	scanner.finish();
+}
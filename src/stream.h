@@ -20,24 +20,16 @@
 	SOFTWARE.
 */
 
-#ifndef VARIABLE_H
-#define VARIABLE_H
+#ifndef STREAM_H
+#define STREAM_H
 
-#include <string>
-#include <cstdint>
+#include "script_context.h"
 
-class variable
-{
-public:
-	variable();
-	variable(const std::string& name, uint64_t value);
 
-	std::string name() const { return _name; }
-	uint64_t value() const { return _value; }
+// Reads a script from fd and runs every element of the top-level array as
+// soon as it is complete, so memory use is bounded by the largest single
+// command rather than the script.
+void stream_process(int fd, script_context& script_context);
 
-private:
-	std::string _name;
-	uint64_t _value;
-};
 
 #endif
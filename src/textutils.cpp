@@ -33,4 +33,28 @@ uint64_t parse_hex(const std::string& str)
 	return std::stoull(str, &pos, 0);
 }
 
+size_t format_uint(char* buffer, uint64_t value, int base, int width, bool zero_pad, bool upper)
+{
+	const char* digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+	char reversed[64];
+	int length = 0;
+
+	do {
+		reversed[length++] = digits[value % base];
+		value /= base;
+	} while (value != 0);
+
+	size_t pos = 0;
+
+	for (int i=length; i < width; ++i) {
+		buffer[pos++] = zero_pad ? '0' : ' ';
+	}
+
+	while (length > 0) {
+		buffer[pos++] = reversed[--length];
+	}
+
+	return pos;
+}
+
 }
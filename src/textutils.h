@@ -30,6 +30,11 @@
 namespace tu
 {
 	uint64_t parse_hex(const std::string& str);
+
+	// Formats value into buffer without a terminator and returns the number
+	// of characters written. The buffer must hold at least max(width, 64)
+	// characters.
+	size_t format_uint(char* buffer, uint64_t value, int base, int width, bool zero_pad, bool upper);
 }
 
 
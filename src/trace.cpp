@@ -0,0 +1,287 @@
+/*
+	Copyright (c) 2017 Willem Kemp
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#include "trace.h"
+#include "polling.h"
+#include "script_exception.h"
+#include "logging.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+static const uint32_t trace_format_version = 2;
+static const char trace_magic[8] = { 'A', 'G', 'M', 'N', 'T', 'R', 'C', 'E' };
+
+// Same scheme as the asynchronous log: a producer may fill a slot when its
+// sequence number equals the claimed position, and the drain thread takes it
+// once the number is one past that position
+struct trace_slot
+{
+	std::atomic<uint64_t> sequence;
+	trace_record record;
+};
+
+static const uint64_t ring_slots = 1 << 18;
+
+bool trace_enabled = false;
+
+static std::unique_ptr<trace_slot[]> ring;
+static std::atomic<uint64_t> ring_head(0);
+static std::atomic<uint64_t> ring_tail(0);
+
+static std::atomic<bool> drain_running(false);
+static std::thread drain_thread;
+
+static FILE* file = nullptr;
+static std::string file_name;
+static uint64_t record_count = 0;
+
+static std::mutex regions_mutex;
+static std::map<uint32_t, std::pair<std::string, trace_region_entry>> regions;
+
+
+static void write_data(const void* data, size_t size)
+{
+	if (fwrite(data, 1, size, file) != size) {
+		LOG(ll_v) << "trace: could not write " << file_name << ": " << strerror(errno);
+	}
+}
+
+static void drain()
+{
+	std::vector<trace_record> buffer;
+	buffer.reserve(4096);
+
+	for (;;) {
+		bool running = drain_running.load(std::memory_order_acquire);
+		uint64_t tail = ring_tail.load(std::memory_order_relaxed);
+
+		while (buffer.size() < buffer.capacity()) {
+			trace_slot& slot(ring[tail & (ring_slots - 1)]);
+			if (slot.sequence.load(std::memory_order_acquire) != tail + 1) {
+				break;
+			}
+
+			buffer.push_back(slot.record);
+			slot.sequence.store(tail + ring_slots, std::memory_order_release);
+			ring_tail.store(++tail, std::memory_order_release);
+		}
+
+		if (!buffer.empty()) {
+			write_data(buffer.data(), buffer.size() * sizeof(trace_record));
+			record_count += buffer.size();
+			buffer.clear();
+		} else if (!running) {
+			break;
+		} else {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+}
+
+void trace_open(const std::string& trace_file)
+{
+	file = fopen(trace_file.c_str(), "wb");
+	if (!file) {
+		throw script_exception(fmt() << "could not create trace file " << trace_file << ": " << strerror(errno));
+	}
+
+	file_name = trace_file;
+	record_count = 0;
+
+	// The header is rewritten with the final counts on close
+	trace_header header;
+	memset(&header, 0, sizeof(header));
+	write_data(&header, sizeof(header));
+
+	ring.reset(new trace_slot[ring_slots]);
+	for (uint64_t i=0; i < ring_slots; ++i) {
+		ring[i].sequence.store(ring_head.load() + i);
+	}
+
+	drain_running = true;
+	drain_thread = std::thread(drain);
+	trace_enabled = true;
+}
+
+void trace_close()
+{
+	if (!file) {
+		return;
+	}
+
+	trace_enabled = false;
+	drain_running = false;
+	drain_thread.join();
+
+	trace_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, trace_magic, sizeof(trace_magic));
+	header.version = trace_format_version;
+	header.record_size = sizeof(trace_record);
+	header.record_count = record_count;
+	header.region_table_offset = sizeof(trace_header) + record_count * sizeof(trace_record);
+
+	{
+		std::lock_guard<std::mutex> lock(regions_mutex);
+		static const char padding[8] = { 0 };
+
+		for (const auto& i : regions) {
+			const std::string& name(i.second.first);
+			write_data(&i.second.second, sizeof(trace_region_entry));
+			write_data(name.data(), name.size());
+			write_data(padding, (8 - name.size() % 8) % 8);
+		}
+		header.region_count = regions.size();
+	}
+
+	fseek(file, 0, SEEK_SET);
+	write_data(&header, sizeof(header));
+
+	if (fclose(file) != 0) {
+		LOG(ll_v) << "trace: could not write " << file_name << ": " << strerror(errno);
+	}
+	file = nullptr;
+	ring.reset();
+}
+
+void trace_declare_region(uint32_t region, const std::string& name, uint64_t address, uint64_t size)
+{
+	trace_region_entry entry;
+	memset(&entry, 0, sizeof(entry));
+	entry.address = address;
+	entry.size = size;
+	entry.region = region;
+	entry.name_size = name.size();
+
+	std::lock_guard<std::mutex> lock(regions_mutex);
+	regions[region] = std::make_pair(name, entry);
+}
+
+void trace_append(uint32_t region, uint64_t offset, uint32_t width, uint64_t value, uint64_t increment, uint64_t count, trace_kind kind)
+{
+	uint64_t timestamp = monotonic_ns();
+	uint64_t pos = ring_head.load(std::memory_order_relaxed);
+	trace_slot* slot;
+
+	for (;;) {
+		slot = &ring[pos & (ring_slots - 1)];
+		uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+		int64_t difference = (int64_t)sequence - (int64_t)pos;
+
+		if (difference == 0) {
+			if (ring_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		} else if (difference < 0) {
+			// Ring is full; waiting keeps the trace complete
+			std::this_thread::yield();
+			pos = ring_head.load(std::memory_order_relaxed);
+		} else {
+			pos = ring_head.load(std::memory_order_relaxed);
+		}
+	}
+
+	trace_record& record(slot->record);
+	record.timestamp_ns = timestamp;
+	record.offset = offset;
+	record.value = value;
+	record.increment = increment;
+	record.count = (count > UINT32_MAX) ? UINT32_MAX : count;
+	record.region = (region > UINT16_MAX) ? UINT16_MAX : region;
+	record.width = width;
+	record.kind = kind;
+
+	slot->sequence.store(pos + 1, std::memory_order_release);
+}
+
+void trace_print(const std::string& trace_file)
+{
+	FILE* input = fopen(trace_file.c_str(), "rb");
+	if (!input) {
+		throw script_exception(fmt() << "could not open trace file " << trace_file << ": " << strerror(errno));
+	}
+	std::unique_ptr<FILE, int (*)(FILE*)> input_closer(input, fclose);
+
+	trace_header header;
+	if (fread(&header, sizeof(header), 1, input) != 1 ||
+		memcmp(header.magic, trace_magic, sizeof(trace_magic)) != 0 ||
+		header.version != trace_format_version ||
+		header.record_size != sizeof(trace_record)) {
+		throw script_exception(fmt() << "invalid trace file " << trace_file);
+	}
+
+	std::map<uint32_t, std::string> names;
+	fseek(input, header.region_table_offset, SEEK_SET);
+	for (uint64_t i=0; i < header.region_count; ++i) {
+		trace_region_entry entry;
+		if (fread(&entry, sizeof(entry), 1, input) != 1) {
+			throw script_exception(fmt() << "truncated trace file " << trace_file);
+		}
+
+		std::string name(entry.name_size + (8 - entry.name_size % 8) % 8, 0);
+		if (!name.empty() && fread(&name[0], name.size(), 1, input) != 1) {
+			throw script_exception(fmt() << "truncated trace file " << trace_file);
+		}
+		name.resize(entry.name_size);
+		names[entry.region] = name;
+	}
+
+	static const char* kinds[] = { "read", "write", "poll", "poll_end", "compare", "mismatch" };
+	uint64_t start = 0;
+
+	fseek(input, sizeof(trace_header), SEEK_SET);
+	for (uint64_t i=0; i < header.record_count; ++i) {
+		trace_record record;
+		if (fread(&record, sizeof(record), 1, input) != 1) {
+			throw script_exception(fmt() << "truncated trace file " << trace_file);
+		}
+
+		if (i == 0) {
+			start = record.timestamp_ns;
+		}
+
+		auto name = names.find(record.region);
+		std::printf("%14.3f %-8s %s+0x%llx %u 0x%llx", (record.timestamp_ns - start) / 1e3,
+			record.kind < sizeof(kinds) / sizeof(kinds[0]) ? kinds[record.kind] : "unknown",
+			name != names.end() ? name->second.c_str() : "?", (unsigned long long)record.offset,
+			(unsigned)record.width, (unsigned long long)record.value);
+
+		if (record.kind == trace_poll) {
+			std::printf(" #%u", record.count);
+		} else if (record.count != 1) {
+			std::printf(" x%u", record.count);
+		}
+		if (record.increment != 0) {
+			std::printf(" +0x%llx", (unsigned long long)record.increment);
+		}
+		std::printf("\n");
+	}
+}
@@ -0,0 +1,135 @@
+/*
+	Copyright (c) 2017 Willem Kemp
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdint>
+#include <string>
+
+
+// Binary trace of the memory accesses made by read_value, write_value,
+// poll_value, wait_any/wait_all and compare_memory. Commands append fixed
+// size records to a preallocated ring buffer, which a background thread
+// writes to the trace file, so tracing costs a timestamp and a few stores
+// per access.
+//
+// File layout: trace_header, record_count trace_records, then region_count
+// region entries (trace_region_entry followed by the name, padded to 8 bytes).
+
+enum trace_kind : uint8_t
+{
+	// A single read
+	trace_read,
+
+	// count elements written, value + i * increment to element i
+	trace_write,
+
+	// A read while polling, recorded for the first read and whenever the
+	// value changes; count is the number of the read
+	trace_poll,
+
+	// The last read of a poll; count is the number of reads
+	trace_poll_end,
+
+	// count elements compared against value + i * increment
+	trace_compare,
+
+	// count consecutive elements of a compare that did not match; value is
+	// the first of them as read
+	trace_mismatch
+};
+
+struct trace_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint64_t record_count;
+	uint64_t region_count;
+	uint64_t region_table_offset;
+};
+
+struct trace_record
+{
+	uint64_t timestamp_ns;
+	uint64_t offset;
+	uint64_t value;
+	uint64_t increment;
+	uint32_t count;
+	uint16_t region;
+	uint8_t width;
+	uint8_t kind;
+};
+
+struct trace_region_entry
+{
+	uint64_t address;
+	uint64_t size;
+	uint32_t region;
+	uint32_t name_size;
+};
+
+extern bool trace_enabled;
+
+void trace_open(const std::string& trace_file);
+
+// Writes the outstanding records and the region table, and closes the file
+void trace_close();
+
+void trace_declare_region(uint32_t region, const std::string& name, uint64_t address, uint64_t size);
+
+void trace_append(uint32_t region, uint64_t offset, uint32_t width, uint64_t value, uint64_t increment, uint64_t count, trace_kind kind);
+
+inline void trace_access(uint32_t region, uint64_t offset, uint32_t width, uint64_t value, uint64_t increment, uint64_t count, trace_kind kind)
+{
+	if (trace_enabled) {
+		trace_append(region, offset, width, value, increment, count, kind);
+	}
+}
+
+// Follows the reads of one polled location
+struct trace_poll_state
+{
+	uint64_t reads;
+	uint64_t last;
+};
+
+inline void trace_poll_sample(trace_poll_state& state, uint32_t region, uint64_t offset, uint32_t width, uint64_t value)
+{
+	if (trace_enabled && (state.reads == 0 || value != state.last)) {
+		trace_append(region, offset, width, value, 0, state.reads + 1, trace_poll);
+	}
+	state.reads++;
+	state.last = value;
+}
+
+inline void trace_poll_finish(const trace_poll_state& state, uint32_t region, uint64_t offset, uint32_t width)
+{
+	trace_access(region, offset, width, state.last, 0, state.reads, trace_poll_end);
+}
+
+// Decodes a trace file as text to stdout
+void trace_print(const std::string& trace_file);
+
+
+#endif
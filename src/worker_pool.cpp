@@ -0,0 +1,322 @@
+/*
+	Copyright (c) 2017 Willem Kemp
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#include "worker_pool.h"
+#include "script_exception.h"
+#include "logging.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+
+// Splitting is not worth waking the workers for less than this per thread
+static const uint64_t min_chunk_size = 1024 * 1024;
+
+struct numa_node
+{
+	int id;
+	std::vector<int> cpus;
+};
+
+struct worker_job
+{
+	const std::function<void(uint64_t, uint64_t)>* fn;
+	std::vector<uint64_t> bounds;
+	std::atomic<unsigned> next_chunk;
+	unsigned remaining;
+	int node;
+	std::exception_ptr error;
+};
+
+// Held for the duration of a job, so only one thread uses the pool at a time
+static std::mutex run_mutex;
+
+static std::mutex mutex;
+static std::condition_variable start_condition;
+static std::condition_variable done_condition;
+static std::vector<std::thread> workers;
+static uint64_t generation = 0;
+static bool stopping = false;
+static worker_job job;
+
+static unsigned thread_count = 1;
+static std::vector<int> worker_cpus;
+static bool pool_changed = false;
+
+static bool topology_loaded = false;
+static std::vector<numa_node> nodes;
+static uint64_t memory_block_size = 0;
+static cpu_set_t process_cpus;
+
+
+std::vector<int> parse_cpu_list(const std::string& list)
+{
+	std::vector<int> cpus;
+	const char* p = list.c_str();
+
+	while (*p != 0 && *p != '\n') {
+		char* end;
+		long first = strtol(p, &end, 10);
+		long last = first;
+		if (*end == '-') {
+			last = strtol(end + 1, &end, 10);
+		}
+		if (end == p || (*end != ',' && *end != 0 && *end != '\n') || first < 0 || last < first || last >= CPU_SETSIZE) {
+			throw script_exception(fmt() << "invalid cpu list: " << list);
+		}
+
+		for (long cpu = first; cpu <= last; ++cpu) {
+			cpus.push_back(cpu);
+		}
+
+		p = (*end == ',') ? end + 1 : end;
+	}
+
+	return cpus;
+}
+
+static void load_topology()
+{
+	topology_loaded = true;
+	sched_getaffinity(0, sizeof(process_cpus), &process_cpus);
+
+	DIR* dir = opendir("/sys/devices/system/node");
+	if (!dir) {
+		return;
+	}
+
+	while (dirent* entry = readdir(dir)) {
+		int id;
+		if (sscanf(entry->d_name, "node%d", &id) != 1) {
+			continue;
+		}
+
+		std::ifstream file(fmt() << "/sys/devices/system/node/" << entry->d_name << "/cpulist");
+		std::string list;
+		std::getline(file, list);
+
+		try {
+			nodes.push_back({ id, parse_cpu_list(list) });
+		} catch (script_exception&) {
+		}
+	}
+	closedir(dir);
+
+	std::ifstream file("/sys/devices/system/memory/block_size_bytes");
+	std::string size;
+	std::getline(file, size);
+	memory_block_size = strtoull(size.c_str(), 0, 16);
+}
+
+// Returns the index in nodes of the node holding physical_address, or -1
+static int node_of(uint64_t physical_address)
+{
+	if (nodes.size() < 2 || memory_block_size == 0) {
+		return -1;
+	}
+
+	uint64_t block = physical_address / memory_block_size;
+	for (size_t i=0; i < nodes.size(); ++i) {
+		std::string path = fmt() << "/sys/devices/system/node/node" << nodes[i].id << "/memory" << block;
+		if (access(path.c_str(), F_OK) == 0) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+static void set_affinity(unsigned index, int node)
+{
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+
+	if (node >= 0) {
+		for (int cpu : nodes[node].cpus) {
+			CPU_SET(cpu, &cpus);
+		}
+	} else if (!worker_cpus.empty()) {
+		CPU_SET(worker_cpus[index % worker_cpus.size()], &cpus);
+	} else {
+		cpus = process_cpus;
+	}
+
+	if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+		LOG(ll_v) << "worker_pool: could not set the affinity of worker " << index;
+	}
+}
+
+static void worker_main(unsigned index)
+{
+	int current_node = -1;
+	uint64_t seen = 0;
+
+	set_affinity(index, -1);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		start_condition.wait(lock, [&] { return stopping || generation != seen; });
+		if (stopping) {
+			return;
+		}
+		seen = generation;
+		lock.unlock();
+
+		if (job.node != current_node) {
+			current_node = job.node;
+			set_affinity(index, current_node);
+		}
+
+		while (true) {
+			unsigned chunk = job.next_chunk++;
+			if (chunk + 1 >= job.bounds.size()) {
+				break;
+			}
+
+			try {
+				(*job.fn)(job.bounds[chunk], job.bounds[chunk + 1]);
+			} catch (...) {
+				std::lock_guard<std::mutex> error_lock(mutex);
+				if (!job.error) {
+					job.error = std::current_exception();
+				}
+			}
+		}
+
+		lock.lock();
+		if (--job.remaining == 0) {
+			done_condition.notify_one();
+		}
+	}
+}
+
+static void stop_workers()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	start_condition.notify_all();
+
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+
+	workers.clear();
+	stopping = false;
+}
+
+static void shutdown()
+{
+	std::lock_guard<std::mutex> lock(run_mutex);
+	stop_workers();
+}
+
+static void start_workers()
+{
+	static bool registered = false;
+	if (!registered) {
+		registered = true;
+		atexit(shutdown);
+	}
+
+	if (!topology_loaded) {
+		load_topology();
+	}
+
+	for (unsigned i=0; i < thread_count; ++i) {
+		workers.push_back(std::thread(worker_main, i));
+	}
+}
+
+void worker_pool_set_threads(unsigned threads)
+{
+	std::lock_guard<std::mutex> lock(run_mutex);
+	thread_count = (threads > 0) ? threads : 1;
+	pool_changed = true;
+}
+
+unsigned worker_pool_threads()
+{
+	return thread_count;
+}
+
+void worker_pool_set_cpus(const std::vector<int>& cpus)
+{
+	std::lock_guard<std::mutex> lock(run_mutex);
+	worker_cpus = cpus;
+	pool_changed = true;
+}
+
+bool worker_pool_splits(uint64_t size)
+{
+	return thread_count > 1 && size >= 2 * min_chunk_size;
+}
+
+void worker_pool_run(uint64_t size, uint64_t granularity, uint64_t physical_address, const std::function<void(uint64_t, uint64_t)>& fn)
+{
+	unsigned chunks = std::min<uint64_t>(thread_count, size / min_chunk_size);
+
+	std::unique_lock<std::mutex> run_lock(run_mutex, std::try_to_lock);
+	if (!run_lock.owns_lock() || chunks < 2) {
+		fn(0, size);
+		return;
+	}
+
+	if (pool_changed) {
+		stop_workers();
+		pool_changed = false;
+	}
+	if (workers.empty()) {
+		start_workers();
+	}
+
+	job.fn = &fn;
+	job.bounds.resize(chunks + 1);
+	for (unsigned i=0; i < chunks; ++i) {
+		job.bounds[i] = (size * i / chunks) / granularity * granularity;
+	}
+	job.bounds[chunks] = size;
+	job.next_chunk = 0;
+	job.node = worker_cpus.empty() ? node_of(physical_address) : -1;
+	job.error = nullptr;
+
+	std::unique_lock<std::mutex> lock(mutex);
+	job.remaining = workers.size();
+	generation++;
+	start_condition.notify_all();
+	done_condition.wait(lock, [] { return job.remaining == 0; });
+
+	if (job.error) {
+		std::rethrow_exception(job.error);
+	}
+}
@@ -0,0 +1,57 @@
+/*
+	Copyright (c) 2017 Willem Kemp
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+
+// Sets the number of threads bulk operations are split across. With a
+// single thread, everything runs on the calling thread.
+void worker_pool_set_threads(unsigned threads);
+unsigned worker_pool_threads();
+
+// Pins worker n to cpus[n % cpus.size()]. Without a list, workers are
+// placed on the NUMA node of the memory they work on, if the host has
+// several nodes.
+void worker_pool_set_cpus(const std::vector<int>& cpus);
+
+// Whether worker_pool_run would split a range of this size at all. Lets
+// callers skip setting up a parallel run for small ranges.
+bool worker_pool_splits(uint64_t size);
+
+// Splits [0, size) into chunks that are multiples of granularity and calls
+// fn(begin, end) for every chunk on the worker threads, returning when all
+// are done. physical_address is the address of byte 0. Runs fn(0, size) on
+// the calling thread if the range is small, the pool has a single thread,
+// or another thread is using the pool.
+void worker_pool_run(uint64_t size, uint64_t granularity, uint64_t physical_address, const std::function<void(uint64_t, uint64_t)>& fn);
+
+// Parses a Linux cpu list such as "0-3,8,10-11"
+std::vector<int> parse_cpu_list(const std::string& list);
+
+
+#endif